@@ -0,0 +1,22 @@
+/* Builtin modules
+
+   A module is a header that lists its builtins in an X-macro, with an entry for each:
+     entry(ENUMNAME, "lisp-name", fptr, fixed, min, max)
+   where fptr takes the arguments as a list and fixed takes them in an array, either being NULL.
+   The list gives the function enum, the names, and the lookup_table entries, which follow the core
+   builtins. When included again with MODULEDEFINITIONS defined the header gives the definitions,
+   after the core functions, which they can call.
+
+   To add a module, include its header below and add its list to MODULEFUNCTIONS.
+*/
+
+#if defined(nativefunctions)
+  #include "NativeFunctions.h"
+#else
+  #define NATIVEFUNCTIONS(entry)
+#endif
+
+#if !defined(MODULEDEFINITIONS)
+#define MODULEFUNCTIONS(entry) \
+  NATIVEFUNCTIONS(entry)
+#endif
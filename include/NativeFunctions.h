@@ -0,0 +1,209 @@
+/* Native functions - generated by tools/lisp2c.py from native.lisp; don't edit */
+
+#if !defined(MODULEDEFINITIONS)
+#define NATIVEFUNCTIONS(entry) \
+  entry(NATIVEFIB, "fib", NULL, fn_native_fib, 1, 1) \
+  entry(NATIVEGCD, "gcd", NULL, fn_native_gcd, 2, 2) \
+  entry(NATIVEISQRT, "isqrt", NULL, fn_native_isqrt, 1, 1) \
+  entry(NATIVECRC8, "crc8", NULL, fn_native_crc8, 1, 1) \
+  entry(NATIVEPARSEINTEGER, "parse-integer", NULL, fn_native_parseinteger, 1, 1) \
+
+#else
+
+object *native_fib (object *v_n, object *env);
+object *native_gcd (object *v_a, object *v_b, object *env);
+object *native_isqrt (object *v_n, object *env);
+object *native_crc8 (object *v_bytes, object *env);
+object *native_parseinteger (object *v_str, object *env);
+
+object *native_fib (object *v_n, object *env) {
+  unsigned int fp = nativeframe(2);
+  Stack[fp+0] = v_n;
+  safepoint(NULL, env);
+  object *result, *t1;
+  if (nativetestint(LESS, Stack[fp+0], 2)) {
+    result = Stack[fp+0];
+  } else {
+    t1 = native_fib(nativearithint(SUBTRACT, Stack[fp+0], 1), env);
+    Stack[fp+1] = t1;
+    result = nativearith(ADD, Stack[fp+1], native_fib(nativearithint(SUBTRACT, Stack[fp+0], 2), env));
+  }
+  StackTop = fp;
+  return result;
+}
+
+object *fn_native_fib (object **args, object *env) {
+  return native_fib(args[0], env);
+}
+
+object *native_gcd (object *v_a, object *v_b, object *env) {
+  unsigned int fp = nativeframe(3);
+  Stack[fp+0] = v_a;
+  Stack[fp+1] = v_b;
+  safepoint(NULL, env);
+  object *result;
+  {
+    for (;;) {
+      if (nativefixed(fn_zerop, Stack[fp+1]) != nil) {
+        result = Stack[fp+0];
+        goto loop1;
+      }
+      Stack[fp+2] = nativefixed(fn_mod, Stack[fp+0], Stack[fp+1]);
+      Stack[fp+0] = Stack[fp+1];
+      Stack[fp+1] = Stack[fp+2];
+      safepoint(NULL, env);
+    }
+  }
+  loop1: ;
+  StackTop = fp;
+  return result;
+}
+
+object *fn_native_gcd (object **args, object *env) {
+  return native_gcd(args[0], args[1], env);
+}
+
+object *native_isqrt (object *v_n, object *env) {
+  unsigned int fp = nativeframe(3);
+  Stack[fp+0] = v_n;
+  safepoint(NULL, env);
+  object *result;
+  if (nativetestint(LESS, Stack[fp+0], 2)) {
+    result = Stack[fp+0];
+  } else {
+    Stack[fp+1] = Stack[fp+0];
+    Stack[fp+2] = fn_ash(cons(nativearithint(ADD, Stack[fp+1], 1), cons(number(-1), NULL)), NULL);
+    {
+      for (;;) {
+        if (!(nativetest(LESS, Stack[fp+2], Stack[fp+1]))) {
+          result = Stack[fp+1];
+          goto loop1;
+        }
+        Stack[fp+1] = Stack[fp+2];
+        Stack[fp+2] = fn_ash(cons(nativearith(ADD, Stack[fp+1], fn_truncate(cons(Stack[fp+0], cons(Stack[fp+1], NULL)), NULL)), cons(number(-1), NULL)), NULL);
+        safepoint(NULL, env);
+      }
+    }
+    loop1: ;
+  }
+  StackTop = fp;
+  return result;
+}
+
+object *fn_native_isqrt (object **args, object *env) {
+  return native_isqrt(args[0], env);
+}
+
+object *native_crc8 (object *v_bytes, object *env) {
+  unsigned int fp = nativeframe(5);
+  Stack[fp+0] = v_bytes;
+  safepoint(NULL, env);
+  object *result;
+  Stack[fp+1] = number(0);
+  {
+    Stack[fp+3] = Stack[fp+0];
+    int index1 = 0;
+    while (dolistitem(&Stack[fp+3], &index1, &Stack[fp+2])) {
+      Stack[fp+1] = fn_logxor(cons(Stack[fp+1], cons(Stack[fp+2], NULL)), NULL);
+      {
+        int count2 = 8, index2 = 0;
+        while (index2 < count2) {
+          Stack[fp+4] = number(index2);
+          if (fn_logbitp(cons(number(7), cons(Stack[fp+1], NULL)), NULL) != nil) {
+            Stack[fp+1] = fn_logand(cons(fn_logxor(cons(fn_ash(cons(Stack[fp+1], cons(number(1), NULL)), NULL), cons(number(7), NULL)), NULL), cons(number(255), NULL)), NULL);
+          } else {
+            Stack[fp+1] = fn_logand(cons(fn_ash(cons(Stack[fp+1], cons(number(1), NULL)), NULL), cons(number(255), NULL)), NULL);
+          }
+          index2++;
+          safepoint(NULL, env);
+        }
+        Stack[fp+4] = number(index2);
+      }
+      safepoint(NULL, env);
+    }
+    Stack[fp+2] = nil;
+    result = Stack[fp+1];
+  }
+  StackTop = fp;
+  return result;
+}
+
+object *fn_native_crc8 (object **args, object *env) {
+  return native_crc8(args[0], env);
+}
+
+object *native_parseinteger (object *v_str, object *env) {
+  unsigned int fp = nativeframe(7);
+  Stack[fp+0] = v_str;
+  safepoint(NULL, env);
+  object *result;
+  Stack[fp+1] = number(0);
+  Stack[fp+2] = number(1);
+  Stack[fp+3] = number(0);
+  Stack[fp+4] = nativefixed(fn_length, Stack[fp+0]);
+  if ((nativetestint(GREATER, Stack[fp+4], 0) && nativefixed(fn_eq, fn_char(cons(Stack[fp+0], cons(number(0), NULL)), NULL), character('-')) != nil)) {
+    Stack[fp+2] = number(-1);
+    Stack[fp+3] = number(1);
+  }
+  {
+    int count1 = checkinteger(DOTIMES, nativearith(SUBTRACT, Stack[fp+4], Stack[fp+3])), index1 = 0;
+    while (index1 < count1) {
+      Stack[fp+5] = number(index1);
+      Stack[fp+6] = nativearithint(SUBTRACT, fn_charcode(cons(fn_char(cons(Stack[fp+0], cons(nativearith(ADD, Stack[fp+5], Stack[fp+3]), NULL)), NULL), NULL), NULL), 48);
+      if ((nativetestint(LESS, Stack[fp+6], 0) || nativetestint(GREATER, Stack[fp+6], 9))) {
+        goto loop1;
+      }
+      Stack[fp+1] = nativearith(ADD, nativearithint(MULTIPLY, Stack[fp+1], 10), Stack[fp+6]);
+      index1++;
+      safepoint(NULL, env);
+    }
+    Stack[fp+5] = number(index1);
+  }
+  loop1: ;
+  result = nativearith(MULTIPLY, Stack[fp+2], Stack[fp+1]);
+  StackTop = fp;
+  return result;
+}
+
+object *fn_native_parseinteger (object **args, object *env) {
+  return native_parseinteger(args[0], env);
+}
+
+// The definitions and test expressions for checknatives()
+
+const char NativeSource[] PROGMEM = 
+"(defun fib (n) (if (< n 2) n (+ (fib (- n 1)) (fib (- n 2)))))"
+"(defun gcd (a b) (loop (when (zerop b) (return a)) (let ((r (mod a b))) (setq a b) (setq b r))))"
+"(defun isqrt (n) \"Integer square root by Newton's method.\" (if (< n 2) n (let* ((x n) (y (ash (+ x 1) -1))) (loop (unless (< y x) (return x)) (setq x y) (setq y (ash (+ x (truncate n x)) -1))))))"
+"(defun crc8 (bytes) \"CRC-8 with polynomial #x07 of a list of bytes.\" (let ((crc 0)) (dolist (b bytes crc) (setq crc (logxor crc b)) (dotimes (i 8) (setq crc (if (logbitp 7 crc) (logand (logxor (ash crc 1) 7) 255) (logand (ash crc 1) 255)))))))"
+"(defun parse-integer (str) \"Value of the decimal digits at the start of str, after an optional sign.\" (let ((result 0) (sign 1) (start 0) (len (length str))) (when (and (> len 0) (eq (char str 0) #\\-)) (setq sign -1 start 1)) (dotimes (i (- len start)) (let ((d (- (char-code (char str (+ i start))) 48))) (when (or (< d 0) (> d 9)) (return)) (setq result (+ (* result 10) d)))) (* sign result)))"
+;
+
+const char NativeCorpus[] PROGMEM = 
+"(fib 0)"
+"(fib 1)"
+"(fib 15)"
+"(fib 2.5)"
+"(fib 'x)"
+"(gcd 12 18)"
+"(gcd 17 5)"
+"(gcd 0 9)"
+"(gcd 9 0)"
+"(gcd -12 18)"
+"(gcd 1.5 2)"
+"(isqrt 0)"
+"(isqrt 15)"
+"(isqrt 16)"
+"(isqrt 1000000)"
+"(isqrt 2147483647)"
+"(crc8 '(1 2 3 4))"
+"(crc8 '(49 50 51 52 53 54 55 56 57))"
+"(crc8 '(1 . 2))"
+"(parse-integer \"1234\")"
+"(parse-integer \"-42abc\")"
+"(parse-integer \"99999999999\")"
+"(parse-integer \"\")"
+"(parse-integer 5)"
+;
+
+#endif
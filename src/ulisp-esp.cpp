@@ -18,6 +18,10 @@
 // #define sdcardsupport
 // #define eepromsupport
 #define lisplibrary
+// #define benchmarks
+// #define nativefunctions
+#define compiler
+// #define selftests
 
 // Includes
 
@@ -34,6 +38,7 @@
   #include <SPIFFS.h>
 #endif
 #include "LispLibrary.h"
+#include "Modules.h"
 
 #if defined(sdcardsupport)
   #include <SD.h>
@@ -59,9 +64,11 @@
 #define integerp(x)        ((x) != NULL && (x)->type == NUMBER)
 #define floatp(x)          ((x) != NULL && (x)->type == FLOAT)
 #define symbolp(x)         ((x) != NULL && (x)->type == SYMBOL)
-#define stringp(x)         ((x) != NULL && (x)->type == STRING)
+#define stringp(x)         ((x) != NULL && ((x)->type == STRING || (x)->type == LONGSTRING))
 #define characterp(x)      ((x) != NULL && (x)->type == CHARACTER)
 #define streamp(x)         ((x) != NULL && (x)->type == STREAM)
+#define codep(x)           ((x) != NULL && (x)->type == CODE)
+#define vectorp(x)         ((x) != NULL && (x)->type == VECTOR)
 
 #define mark(x)            (car(x) = (object *)(((uintptr_t)(car(x))) | MARKBIT))
 #define unmark(x)          (car(x) = (object *)(((uintptr_t)(car(x))) & ~MARKBIT))
@@ -78,13 +85,14 @@
 // Constants
 
 const int TRACEMAX = 3; // Number of traced functions
-enum type { ZERO=0, SYMBOL=2, NUMBER=4, STREAM=6, CHARACTER=8, FLOAT=10, STRING=12, PAIR=14 };  // STRING and PAIR must be last
+const int SHORTSTRING = 8; // Longest string kept as a chain of cells rather than contiguously
+enum type { ZERO=0, SYMBOL=2, NUMBER=4, STREAM=6, CHARACTER=8, FLOAT=10, LOCAL=12, CODE=14, BYTECODE=16, CALLSITE=18, TYPED=20, VECTOR=22, LONGSTRING=24, STRING=26, PAIR=28 };  // STRING and PAIR must be last
 enum token { UNUSED, BRA, KET, QUO, DOT };
 enum stream { SERIALSTREAM, I2CSTREAM, SPISTREAM, SDSTREAM, SPIFFSSTREAM, WIFISTREAM };
 
-enum function { NIL, TEE, NOTHING, OPTIONAL, AMPREST, LAMBDA, LET, LETSTAR, CLOSURE, SPECIAL_FORMS, QUOTE,
-DEFUN, DEFVAR, SETQ, LOOP, RETURN, PUSH, POP, INCF, DECF, SETF, DOLIST, DOTIMES, TRACE, UNTRACE,
-FORMILLIS, WITHSERIAL, WITHI2C, WITHSPI, WITHSDCARD, WITHSPIFFS,  WITHCLIENT, TAIL_FORMS, PROGN, IF, COND, WHEN,
+enum function { NIL, TEE, NOTHING, OPTIONAL, AMPREST, LAMBDA, LET, LETSTAR, CLOSURE, MACRO, SPECIAL_FORMS, QUOTE,
+DEFUN, DEFMACRO, DEFVAR, SETQ, LOOP, RETURN, PUSH, POP, INCF, DECF, SETF, DOLIST, DOTIMES, TRACE, UNTRACE,
+FORMILLIS, WITHSERIAL, WITHI2C, WITHSPI, WITHSDCARD, WITHSPIFFS,  WITHCLIENT, DECLARE, TAIL_FORMS, PROGN, IF, COND, WHEN,
 UNLESS, CASE, AND, OR, FUNCTIONS, NOT, NULLFN, CONS, ATOM, LISTP, CONSP, SYMBOLP, STREAMP, EQ, CAR, FIRST,
 CDR, REST, CAAR, CADR, SECOND, CDAR, CDDR, CAAAR, CAADR, CADAR, CADDR, THIRD, CDAAR, CDADR, CDDAR, CDDDR,
 LENGTH, LIST, REVERSE, NTH, ASSOC, MEMBER, APPLY, FUNCALL, APPEND, MAPC, MAPCAR, MAPCAN, ADD, SUBTRACT,
@@ -96,7 +104,10 @@ READFROMSTRING, PRINCTOSTRING, PRIN1TOSTRING, LOGAND, LOGIOR, LOGXOR, LOGNOT, AS
 LOCALS, MAKUNBOUND, BREAK, READ, PRIN1, PRINT, PRINC, TERPRI, READBYTE, READLINE, WRITEBYTE, WRITESTRING,
 WRITELINE, RESTARTI2C, GC, ROOM, SAVEIMAGE, LOADIMAGE, CLS, PINMODE, DIGITALREAD, DIGITALWRITE,
 ANALOGREAD, ANALOGWRITE, DELAY, MILLIS, SLEEP, NOTE, EDIT, PPRINT, PPRINTALL, REQUIRE, LISTLIBRARY,
-AVAILABLE, WIFISERVER, WIFISOFTAP, CONNECTED, WIFILOCALIP, WIFICONNECT, ENDFUNCTIONS };
+AVAILABLE, WIFISERVER, WIFISOFTAP, CONNECTED, WIFILOCALIP, WIFICONNECT, MAKEARRAY, AREF, VECTORP,
+READSEQUENCE, WRITESEQUENCE,
+#define MODULEENUM(name, lispname, fptr, fixed, min, max) name,
+MODULEFUNCTIONS(MODULEENUM) ENDFUNCTIONS };
 
 // Typedefs
 
@@ -136,11 +147,12 @@ typedef struct sobject {
 } object;
 
 typedef object *(*fn_ptr_type)(object *, object *);
+typedef object *(*fn_fixed_type)(object **, object *);
 
 typedef struct {
   int id;
   void* address;  // Physical address
-  int offset;     // First free byte in page;
+  object *freelist; // Free cells in page
   int useCount;
   int mfuPageId;
   int lfuPageId;
@@ -152,22 +164,58 @@ typedef struct {
   fn_ptr_type fptr;
   uint8_t min;
   uint8_t max;
+  fn_fixed_type fixed;  // Entry point taking min arguments in an array, or two if min != max
 } tbl_entry_t;
 
+typedef struct {
+  uint16_t length;    // Bytes of code
+  uint8_t nconsts;    // Constants, stored before the code
+  uint8_t maxstack;   // Deepest use of the value stack
+} bytecode_t;
+
+typedef struct {
+  unsigned int length;
+  unsigned int bytes; // Elements are bytes rather than objects
+} vector_t;           // Elements follow, aligned by the size of the header
+
+typedef struct {
+  object *string;     // A LONGSTRING with room for size characters, once there are more than SHORTSTRING
+  unsigned int size, length;
+  symbol_t name;      // For reporting a failure to grow
+  char chars[SHORTSTRING]; // The characters until then
+} builder_t;
+
+typedef struct {
+  bytecode_t *bc;     // Where a compiled caller continues
+  uint8_t *pc;
+  unsigned int fp;
+  symbol_t name;
+  int trace;
+  boolean tailcalled;
+} frame_t;
+
 typedef int (*gfun_t)();
 typedef void (*pfun_t)(char);
 typedef int PinMode;
 
 // Workspace
 #define WORDALIGNED __attribute__((aligned (4)))
-#define BUFFERSIZE 34  // Number of bits+2
+#define SCRATCHSIZE 128  /* Bytes for tokens, filenames, and symbol names */
+#define PACKED40 102400000  /* 40^5, lowest radix-40 packed name */
+#define MAXHOPS 32  /* Deepest lexical reference that is resolved in advance */
+#define ESCAPELATENCY 10000  /* Microseconds between yields and checks for the escape key */
+#define POLLEVALS 16  /* Safepoints between reading the time since the last yield */
+#define TYPEDFLOAT 1  /* Typed call on floats rather than fixnums */
+#define UNCHECKED 2  /* Typed call compiled with safety 0 */
 
 #if defined(ESP8266)
   #define PSTR(s) s
   #define PROGMEM
   #define WORKSPACESIZE 3072-SDSIZE       /* Cells (8*bytes) */
   #define EEPROMSIZE 4096                 /* Bytes available for EEPROM */
-  #define SYMBOLTABLESIZE 512             /* Bytes */
+  #define SYMBOLTABLESIZE 512             /* Initial bytes, grows as needed */
+  #define STACKSIZE 512                   /* Initial values on the value stack, grows as needed */
+  #define MAXDEPTH 512                    /* Deepest nesting of calls between compiled functions */
   #define SDCARD_SS_PIN 10
   uint8_t _end;
   typedef int BitOrder;
@@ -175,7 +223,9 @@ typedef int PinMode;
 #elif defined(ESP32)
   #define WORKSPACESIZE 8000-SDSIZE       /* Cells (8*bytes) */
   #define EEPROMSIZE 4096                 /* Bytes available for EEPROM */
-  #define SYMBOLTABLESIZE 1024            /* Bytes */
+  #define SYMBOLTABLESIZE 1024            /* Initial bytes, grows as needed */
+  #define STACKSIZE 2048                  /* Initial values on the value stack, grows as needed */
+  #define MAXDEPTH 4096                   /* Deepest nesting of calls between compiled functions */
   #define analogWrite(x,y) dacWrite((x),(y))
   #define SDCARD_SS_PIN 13
   uint8_t _end;
@@ -186,34 +236,76 @@ typedef int PinMode;
 #define NUMPAGES 200
 #define NUMPAGESRESIDENT 100
 #define PAGESIZE 64
+#define HEAPSIZE (NUMPAGESRESIDENT*PAGESIZE) /* Cells that can be collected */
+#define GCRESERVE (HEAPSIZE>>4)              /* Minimum cells kept free between collections */
+#define INTERNSIZE 256                       /* Initial slots for interned symbols, power of 2 */
+#define BUILTINHASHSIZE 512                  /* Slots for builtin names, power of 2 */
+#define LOCALNAMESSIZE 64                    /* Initial slots for names bound locally, power of 2 */
 
 unsigned int Nursery = 0;
 unsigned int LFU = 1;
 page Pages[NUMPAGES];
 object PageBuffer[NUMPAGESRESIDENT][PAGESIZE] WORDALIGNED;
-
-char SymbolTable[SYMBOLTABLESIZE];
+object Builtins[ENDFUNCTIONS] WORDALIGNED;
+object LocalTags[MAXHOPS] WORDALIGNED;
+object TypedTags[4] WORDALIGNED;
+object **Interned = NULL;           // Name to symbol object
+unsigned int InternCount = 0, InternSize = 0;
+uint16_t BuiltinHash[BUILTINHASHSIZE];
+
+// Long symbols - names in id order, with indexes from id to name and name to id
+char *SymbolTable = NULL;
+unsigned int SymbolTop = 0;         // Bytes used
+unsigned int SymbolTableSize = 0;   // Bytes allocated
+uint16_t *SymbolOffset = NULL;      // Id to offset in SymbolTable
+unsigned int SymbolCount = 0, SymbolMax = 0;
+uint16_t *SymbolHash = NULL;        // Name hash to id+1
+unsigned int SymbolHashSize = 0;
+
+char Scratch[SCRATCHSIZE];
 
 // Global variables
 
 jmp_buf exception;
 unsigned int Freespace = 0;
-object *Freelist;
-char *SymbolTop = SymbolTable;
+unsigned int GCThreshold = HEAPSIZE>>4;
+unsigned int GCFree = HEAPSIZE;
+unsigned int GCEvals = 0;
+unsigned int PollCount = 1;                   // Safepoints until the time is next read
+unsigned long PollTime = 0, PollWorst = 0;    // Time of the last poll, and the longest gap between polls
 unsigned int I2CCount;
 unsigned int TraceFn[TRACEMAX];
 unsigned int TraceDepth[TRACEMAX];
 
 object *GlobalEnv;
+object **GlobalIndex = NULL;        // Symbol name to its pair in GlobalEnv
+unsigned int GlobalCount = 0, GlobalIndexSize = 0;
+unsigned int GlobalEpoch = 1;       // Changes whenever a call site's cached function may be out of date
+object *FoldToken = NULL;           // Replaced whenever a builtin or macro may have been redefined, so folded code is out of date
+boolean Folded = false;
+object *Expansions = NULL;          // Macro calls expanded for the function being analysed, as (call . expansion)
+object *Unexpanded = NULL;          // Macro calls found by the analysis that aren't in Expansions
+object *Declared = NULL;            // Types declared in the code being analysed, as (scope . kind)
+int Safety = 1;                     // Safety level declared in the code being analysed
+symbol_t *LocalNames = NULL;        // Names that have been bound locally, hashed
+unsigned int LocalNamesCount = 0, LocalNamesSize = 0;
 object *GCStack = NULL;
+object *PlaceVector = NULL;         // Vector holding the place being updated, kept while the new value is evaluated
+object *PlaceByte = NULL;           // Value of the byte at PlaceIndex in PlaceVector, when that's the place
+int PlaceIndex = 0;
+object **Stack = NULL;              // Arguments of builtins, and values in use by compiled functions
+unsigned int StackTop = 0, StackSize = 0;
+frame_t *Frames = NULL;             // Callers of compiled functions waiting for them to return
+unsigned int FrameTop = 0, FrameSize = 0;
 object *GlobalString;
 int GlobalStringIndex = 0;
+builder_t *GlobalBuilder = NULL;    // Where pstr appends
 char BreakLevel = 0;
 char LastChar = 0;
 char LastPrint = 0;
 
 // Flags
-enum flag { PRINTREADABLY, RETURNFLAG, ESCAPE, EXITEDITOR, LIBRARYLOADED, NOESC };
+enum flag { PRINTREADABLY, RETURNFLAG, ESCAPE, EXITEDITOR, LIBRARYLOADED, NOESC, NOGC };
 volatile char Flags = 0b00001; // PRINTREADABLY set by default
 
 // Forward references
@@ -225,11 +317,12 @@ void repl(object *env);
 void printobject (object *form, pfun_t pfun);
 char *lookupbuiltin (symbol_t name);
 intptr_t lookupfn (symbol_t name);
+fn_fixed_type fixedfn (object *function, int nargs);
+object *callfn (symbol_t name, object *args, object *env);
 int builtin (char* n);
 void error (symbol_t fname, PGM_P string, object *symbol);
 void error2 (symbol_t fname, PGM_P string);
 
-inline int maxbuffer (char *buffer);
 char nthchar (object *string, int n);
 boolean listp (object *x);
 object *apply (symbol_t name, object *function, object *args, object *env);
@@ -241,20 +334,33 @@ void pln (pfun_t pfun);
 void pstring (char *s, pfun_t pfun);
 char *lookupsymbol (symbol_t name) ;
 int listlength (symbol_t name, object *list);
+boolean consp (object *x);
 uint8_t lookupmin (symbol_t name);
+fn_fixed_type lookupfixed (symbol_t name);
 uint8_t lookupmax (symbol_t name);
 char *cstring (object *form, char *buffer, int buflen);
 void pint (int i, pfun_t pfun);
 void testescape ();
+void safepoint (object *form, object *env);
 int gserial ();
 object *read (gfun_t gfun);
+object *readrest (gfun_t gfun);
 void deletesymbol (symbol_t name);
+void indexglobals ();
+object *local (object *ref, object *env);
+bytecode_t *compiled (object *function);
+object *vmrun (symbol_t name, object *function, object *state, object *args, object *env);
+void growsymbols (unsigned int bytes);
+void growstack (unsigned int slots);
+void growframes ();
+void indexsymbols ();
 void printstring (object *form, pfun_t pfun);
 object *edit (object *fun);
 void superprint (object *form, int lm, pfun_t pfun);
 void supersub (object *form, int lm, int super, pfun_t pfun);
 int subwidthlist (object *form, int w);
 int glibrary ();
+boolean quoted (object *obj);
 
 /* void mark(object *x) {
   object *obj = (object *)(((uintptr_t)(car(x))) | MARKBIT);
@@ -282,11 +388,11 @@ void initpagebuffer (object buffer[]) {
 }
 
 void initworkspace () {
-  Freespace = NUMPAGES*PAGESIZE;
+  Freespace = HEAPSIZE;
   for (int i=0; i<NUMPAGES; i++) {
     page *pg = &Pages[i];
     pg->id = i;
-    pg->offset = 0;
+    pg->freelist = NULL;
     pg->useCount = 0;
     pg->mfuPageId = (i-1+NUMPAGES) % NUMPAGES;
     pg->lfuPageId = (i+1) % NUMPAGES;
@@ -294,6 +400,7 @@ void initworkspace () {
     if (i < NUMPAGESRESIDENT) {
       pg->address = &PageBuffer[i];
       initpagebuffer((object *)pg->address);
+      pg->freelist = (object *)pg->address;
     } else {
       pg->address = NULL;
     }
@@ -317,45 +424,28 @@ void loadpage (unsigned int from, unsigned int to) {
 }
 
 object *myalloc () {
-  // Try to allocate in nursery. 
+  // Try to allocate in nursery.
   page *nursery = &Pages[Nursery];
+  if (nursery->freelist == NULL) {
+    // Move nursery to next resident LFU page with space available.
+    unsigned int start = Nursery;
+    do {
+      Nursery = nursery->lfuPageId;
+      nursery = &Pages[Nursery];
+    } while (Nursery != start && (nursery->address == NULL || nursery->freelist == NULL));
+    if (nursery->freelist == NULL) error2(0, PSTR("no room"));
+  }
+  object *obj = nursery->freelist;
+  nursery->freelist = cdr(obj);
+  nursery->flags |= DIRTY;
   Freespace--;
-  int offset = (nursery->offset+1) % PAGESIZE;
-  object *obj = &PageBuffer[Nursery][offset];
-  while (offset != nursery->offset && obj->car != NULL) {
-    offset = (offset+1) % PAGESIZE;
-    obj = &PageBuffer[Nursery][offset];
-  }
-  if (offset != nursery->offset) {
-    nursery->offset = offset;
-    nursery->flags |= DIRTY;
-    return &PageBuffer[Nursery][offset];
-  }
-
-  // Move nursery to resident LFU page with space available.
-  nursery->offset = PAGESIZE;
-  while (nursery->offset == PAGESIZE && nursery->address != NULL) {
-    Nursery = nursery->lfuPageId;
-    nursery = &Pages[Nursery];
-  }
-  if (nursery->address != NULL) {
-    if (nursery->offset == PAGESIZE) error2(0, PSTR("no room"));
-    offset = nursery->offset;
-    nursery->offset = (offset+1) % PAGESIZE;
-    nursery->flags |= DIRTY;
-    return &PageBuffer[Nursery][offset];
-  }
-
-  // Save page if dirty.
-  if ((nursery->flags & DIRTY) > 0) {
-    savepage(nursery->id);
-  }
+  return obj;
 }
 
-inline void myfree (object *obj) {
+inline void myfree (page *pg, object *obj) {
   car(obj) = NULL;
-  cdr(obj) = Freelist;
-  Freelist = obj;
+  cdr(obj) = pg->freelist;
+  pg->freelist = obj;
   Freespace++;
 }
 
@@ -389,22 +479,73 @@ object *cons (object *arg1, object *arg2) {
   return ptr;
 }
 
+// Hash tables are open addressed: a key probes from its slot to the next empty one, and an empty
+// slot is 0. A table doubles in size before it would be more than three quarters full
+
+inline unsigned int hashslot (unsigned int key, unsigned int size) {
+  return (key ^ key>>8 ^ key>>16) & (size-1);
+}
+
+inline unsigned int nextslot (unsigned int slot, unsigned int size) {
+  return (slot+1) & (size-1);
+}
+
+inline boolean tablefull (unsigned int count, unsigned int size) {
+  return (count+1) * 4 > size * 3;
+}
+
+// The size, doubling from initial, with room for one more than count entries
+unsigned int tablesize (unsigned int count, unsigned int initial) {
+  unsigned int size = initial;
+  while (tablefull(count, size)) size = size * 2;
+  return size;
+}
+
+// Reallocates table, or a new one if it's NULL, with size empty slots of the given bytes
+void *cleartable (void *table, unsigned int size, size_t slot, PGM_P full) {
+  table = realloc(table, size * slot);
+  if (table == NULL) error2(0, full);
+  memset(table, 0, size * slot);
+  return table;
+}
+
+// Symbols are interned, so each name has one object
+
+void intern (object *ptr) {
+  if (tablefull(InternCount, InternSize)) {
+    unsigned int size = tablesize(InternCount, INTERNSIZE);
+    object **old = Interned;
+    unsigned int oldsize = InternSize;
+    Interned = (object **)cleartable(NULL, size, sizeof(object *), PSTR("no room for symbols"));
+    InternSize = size; InternCount = 0;
+    for (unsigned int i=0; i<oldsize; i++) if (old[i] != NULL) intern(old[i]);
+    free(old);
+  }
+  unsigned int i = hashslot(ptr->name, InternSize);
+  while (Interned[i] != NULL) {
+    if (Interned[i]->name == ptr->name) return;
+    i = nextslot(i, InternSize);
+  }
+  Interned[i] = ptr;
+  InternCount++;
+}
+
 object *symbol (symbol_t name) {
+  if (name < ENDFUNCTIONS) return &Builtins[name];
+  if (InternSize != 0) {
+    unsigned int i = hashslot(name, InternSize);
+    while (Interned[i] != NULL) {
+      if (Interned[i]->name == name) return Interned[i];
+      i = nextslot(i, InternSize);
+    }
+  }
   object *ptr = myalloc();
   ptr->type = SYMBOL;
   ptr->name = name;
+  intern(ptr);
   return ptr;
 }
 
-object *newsymbol (symbol_t name) {
-  // TODO Check for duplicate symbols
-/*   for (int i=WORKSPACESIZE-1; i>=0; i--) {
-    object *obj = &Workspace[i];
-    if (obj->type == SYMBOL && obj->name == name) return obj;
-  } */
-  return symbol(name);
-}
-
 object *stream (unsigned char streamtype, unsigned char address) {
   object *ptr = myalloc();
   ptr->type = STREAM;
@@ -412,11 +553,144 @@ object *stream (unsigned char streamtype, unsigned char address) {
   return ptr;
 }
 
+// Blocks outside the workspace bring the next collection forward as if they were made of cells
+
+vector_t *makeblock (symbol_t name, int length, size_t size) {
+  vector_t *v = (vector_t *)malloc(sizeof(vector_t) + size);
+  if (v == NULL) error(name, PSTR("no room for data"), number(length));
+  GCThreshold = GCThreshold + size/sizeof(object);
+  v->length = length;
+  return v;
+}
+
+// A vector's elements are in a block outside the workspace, freed when the vector is collected.
+// A byte vector holds the bytes themselves, so a buffer can be handed straight to a stream
+
+object *makevector (symbol_t name, int length, object *initial, boolean bytes) {
+  if (length < 0) error(name, PSTR("invalid size"), number(length));
+  object *ptr = myalloc();
+  ptr->type = VECTOR;
+  cdr(ptr) = NULL;
+  vector_t *v = makeblock(name, length, length * (bytes ? 1 : sizeof(object *)));
+  v->bytes = bytes;
+  if (bytes) memset(v + 1, (initial == NULL) ? 0 : initial->integer, length); // Checked by the caller
+  else {
+    object **elements = (object **)(v + 1);
+    for (int i=0; i<length; i++) elements[i] = initial;
+  }
+  cdr(ptr) = (object *)v;
+  return ptr;
+}
+
+inline int vectorlength (object *vector) {
+  vector_t *v = (vector_t *)cdr(vector);
+  return (v == NULL) ? 0 : v->length;
+}
+
+inline object **vectorelements (object *vector) {
+  return (object **)((vector_t *)cdr(vector) + 1);
+}
+
+inline uint8_t *vectorbytes (object *vector) {
+  return (uint8_t *)((vector_t *)cdr(vector) + 1);
+}
+
+inline boolean bytevectorp (object *x) {
+  return vectorp(x) && cdr(x) != NULL && ((vector_t *)cdr(x))->bytes;
+}
+
+// Element i, which must be in range
+object *vectorref (object *vector, int i) {
+  if (bytevectorp(vector)) return number(vectorbytes(vector)[i]);
+  return vectorelements(vector)[i];
+}
+
+// A string longer than SHORTSTRING has its characters in a block like a byte vector's, with
+// a 0 after them, so indexing, comparing, and copying it don't have to walk a chain of cells
+
+vector_t *stringblock (symbol_t name, int length) {
+  vector_t *v = makeblock(name, length, length + 1);
+  v->bytes = true;
+  ((char *)(v + 1))[length] = '\0';
+  return v;
+}
+
+object *makelongstring (symbol_t name, const char *chars, int length) {
+  object *ptr = myalloc();
+  ptr->type = LONGSTRING;
+  cdr(ptr) = NULL;
+  vector_t *v = stringblock(name, length);
+  if (chars != NULL) memcpy(v + 1, chars, length);
+  cdr(ptr) = (object *)v;
+  return ptr;
+}
+
+inline char *stringchars (object *string) {
+  return (char *)((vector_t *)cdr(string) + 1);
+}
+
+// A string whose length isn't known in advance is built in the builder until it's too long to be
+// a chain of cells, and then in a block that doubles when full. The builder is local to its caller,
+// so builds can nest, and if an error abandons one the collector frees its block along with the
+// unreferenced string. size is the expected length, if known, or 0
+
+void startstring (symbol_t name, builder_t *b, int size) {
+  b->string = NULL;
+  b->size = size;
+  b->length = 0;
+  b->name = name;
+}
+
+void appendstring (builder_t *b, const char *chars, int n) {
+  if (b->string == NULL) {
+    if (b->length + n <= SHORTSTRING) {
+      memcpy(b->chars + b->length, chars, n);
+      b->length = b->length + n;
+      return;
+    }
+    unsigned int size = (b->size > SHORTSTRING) ? b->size : SHORTSTRING*2;
+    if (size < b->length + n) size = b->length + n;
+    b->string = makelongstring(b->name, NULL, size);
+    memcpy(stringchars(b->string), b->chars, b->length);
+    b->size = size;
+  }
+  if (b->length + n > b->size) {
+    unsigned int size = b->size * 2;
+    if (size < b->length + n) size = b->length + n;
+    vector_t *v = (vector_t *)realloc(cdr(b->string), sizeof(vector_t) + size + 1);
+    if (v == NULL) error(b->name, PSTR("no room for data"), number(size));
+    GCThreshold = GCThreshold + (size - b->size)/sizeof(object);
+    cdr(b->string) = (object *)v;
+    b->size = size;
+  }
+  memcpy(stringchars(b->string) + b->length, chars, n);
+  b->length = b->length + n;
+}
+
+inline void appendchar (builder_t *b, char ch) {
+  if (b->string == NULL && b->length < SHORTSTRING) b->chars[b->length++] = ch;
+  else if (b->string != NULL && b->length < b->size) stringchars(b->string)[b->length++] = ch;
+  else appendstring(b, &ch, 1);
+}
+
+object *makestring (symbol_t name, const char *s, int length);
+
+object *finishstring (builder_t *b) {
+  if (b->string == NULL) return makestring(b->name, b->chars, b->length);
+  vector_t *v = (vector_t *)cdr(b->string);
+  v->length = b->length;
+  stringchars(b->string)[b->length] = '\0';
+  return b->string;
+}
+
 // Garbage collection
 
 void markobject (object *obj) {
   MARK:
   if (obj == NULL) return;
+  if (obj >= Builtins && obj < &Builtins[ENDFUNCTIONS]) return;
+  if (obj >= LocalTags && obj < &LocalTags[MAXHOPS]) return;
+  if (obj >= TypedTags && obj < &TypedTags[4]) return;
   if (marked(obj)) return;
 
   object* arg = car(obj);
@@ -429,9 +703,34 @@ void markobject (object *obj) {
     goto MARK;
   }
 
+  if (type == CODE) {
+    obj = cdr(obj);
+    goto MARK;
+  }
+
+  #if defined(compiler)
+  if (type == BYTECODE) {
+    bytecode_t *bc = (bytecode_t *)cdr(obj);
+    if (bc == NULL) return;
+    object **consts = (object **)(bc + 1);
+    for (int i=0; i<bc->nconsts; i++) markobject(consts[i]);
+    return;
+  }
+  #endif
+
+  if (type == VECTOR) {
+    vector_t *v = (vector_t *)cdr(obj);
+    if (v == NULL || v->bytes) return;
+    int length = v->length;
+    object **elements = vectorelements(obj);
+    for (int i=0; i<length; i++) markobject(elements[i]);
+    return;
+  }
+
   if (type == STRING) {
+    // Each cell's car links to the next, so the last one reads as type ZERO and can't be told by its type
     obj = cdr(obj);
-    while (obj != NULL && obj->type >= PAIR && !marked(obj)) {
+    while (obj != NULL && !marked(obj)) {
       arg = car(obj);
       mark(obj);
       obj = arg;
@@ -440,31 +739,105 @@ void markobject (object *obj) {
 }
 
 void sweep () {
-  Freelist = NULL;
   Freespace = 0;
+  // Rebuild the interned symbols from the ones that survive
+  if (InternSize != 0) memset(Interned, 0, InternSize * sizeof(object *));
+  InternCount = 0;
   for (int i=0; i<NUMPAGESRESIDENT; i++) {
-    for (int j=0; j<PAGESIZE; j++) {
+    page *pg = &Pages[i];
+    pg->freelist = NULL;
+    for (int j=PAGESIZE-1; j>=0; j--) {
       object *obj = &PageBuffer[i][j];
-      if (!marked(obj)) myfree(obj); else unmark(obj);
+      if (!marked(obj)) {
+        #if defined(compiler)
+        if (obj->type == BYTECODE) free(cdr(obj));
+        #endif
+        if (obj->type == VECTOR || obj->type == LONGSTRING) free(cdr(obj));
+        myfree(pg, obj);
+      } else {
+        unmark(obj);
+        if (obj->type == SYMBOL) intern(obj);
+      }
     }
   }
 }
 
+// Size the next collection from the live data and the recent allocation rate
+
+void gcpolicy (unsigned int start) {
+  unsigned int allocated = (GCFree > start) ? GCFree - start : 0;
+  unsigned int rate = (GCEvals == 0) ? allocated : allocated/GCEvals;
+  // Keep enough in reserve for the largest burst a builtin is likely to allocate between evals
+  unsigned int reserve = rate<<5;
+  // With a large live size, never wait for less than half of what was freed
+  if (reserve > Freespace>>1) reserve = Freespace>>1;
+  // But always keep the fixed margin, for a builtin that allocates more than the recent rate suggests
+  if (reserve < GCRESERVE) reserve = GCRESERVE;
+  GCThreshold = reserve;
+  GCFree = Freespace;
+  GCEvals = 0;
+}
+
 void gc (object *form, object *env) {
-  #if defined(printgcs)
-  int start = Freespace; 
-  #endif
+  int start = Freespace;
   markobject(tee);
   markobject(GlobalEnv);
   markobject(GCStack);
+  markobject(FoldToken);
+  markobject(Expansions);
+  markobject(PlaceVector);
+  markobject(PlaceByte);
   markobject(form);
   markobject(env);
+  for (unsigned int i=0; i<StackTop; i++) markobject(Stack[i]);
   sweep();
+  gcpolicy(start);
   #if defined(printgcs)
   pfl(pserial); pserial('{'); pint(Freespace - start, pserial); pserial('}');
   #endif
 }
 
+// Collects now if a builtin about to make cells for each element of list might run out, as myalloc
+// can't collect; the builtin's arguments are protected by its caller, and protect is marked too
+
+void roomfor (object *list, unsigned int cells, object *protect, object *env) {
+  unsigned int need = 0;
+  while (consp(list) && need < Freespace) { need = need + cells; list = cdr(list); }
+  if (need >= Freespace && !tstflag(NOGC)) gc(protect, env);
+}
+
+// Bytecode, vector elements, and long strings are kept outside the workspace, so a loaded
+// image has to compile its functions again, and reads the blocks of its vectors and long
+// strings from after the cells
+
+void forgetblocks (boolean release) {
+  for (int i=0; i<NUMPAGESRESIDENT; i++) {
+    for (int j=0; j<PAGESIZE; j++) {
+      object *obj = &PageBuffer[i][j];
+      if (obj->type == BYTECODE || obj->type == VECTOR || obj->type == LONGSTRING) {
+        if (release) free(cdr(obj));
+        cdr(obj) = NULL;
+      }
+    }
+  }
+}
+
+// In an image, each vector or long string's block follows the cells, in the same order as the cells:
+// its length, whether its elements are bytes, and then the bytes, or the elements as addresses
+// written like those in the cells
+
+inline boolean blockp (object *obj) {
+  return obj->type == VECTOR || obj->type == LONGSTRING;
+}
+
+vector_t *loadblock (object *obj, int length, boolean bytes) {
+  vector_t *v = (obj->type == LONGSTRING) ? stringblock(LOADIMAGE, length) :
+    makeblock(LOADIMAGE, length, length * (bytes ? 1 : sizeof(object *)));
+  v->bytes = bytes;
+  cdr(obj) = (object *)v;
+  return v;
+}
+
 // Compact image
 
 void movepointer (object *from, object *to) {
@@ -522,8 +895,8 @@ int compactimage (object **arg) {
 // Make SD card filename
 
 char *MakeFilename (object *arg) {
-  char *buffer = SymbolTop;
-  int max = maxbuffer(buffer);
+  char *buffer = Scratch;
+  int max = SCRATCHSIZE-1;
   buffer[0]='/';
   int i = 1;
   do {
@@ -569,20 +942,33 @@ unsigned int saveimage (object *arg) {
   SDWriteInt(file, imagesize);
   SDWriteInt(file, (uintptr_t)GlobalEnv);
   SDWriteInt(file, (uintptr_t)GCStack);
-  #if SYMBOLTABLESIZE > BUFFERSIZE
-  SDWriteInt(file, (uintptr_t)SymbolTop);
-  for (int i=0; i<SYMBOLTABLESIZE; i++) file.write(SymbolTable[i]);
-  #endif
+  SDWriteInt(file, SymbolTop);
+  for (unsigned int i=0; i<SymbolTop; i++) file.write(SymbolTable[i]);
   for (unsigned int i=0; i<imagesize; i++) {
     object *obj = &Workspace[i];
     SDWriteInt(file, (uintptr_t)car(obj));
     SDWriteInt(file, (uintptr_t)cdr(obj));
   }
+  for (unsigned int i=0; i<imagesize; i++) {
+    object *obj = &Workspace[i];
+    if (!blockp(obj)) continue;
+    vector_t *v = (vector_t *)cdr(obj);
+    SDWriteInt(file, v->length);
+    SDWriteInt(file, v->bytes);
+    if (v->bytes) file.write((uint8_t *)(v + 1), v->length);
+    else for (unsigned int k=0; k<v->length; k++) SDWriteInt(file, (uintptr_t)((object **)(v + 1))[k]);
+  }
   file.close();
   return imagesize;
 #elif defined(eepromsupport)
   if (!(arg == NULL || listp(arg))) error(SAVEIMAGE, PSTR("illegal argument"), arg);
-  int bytesneeded = imagesize*8 + SYMBOLTABLESIZE + 36;
+  int bytesneeded = imagesize*8 + SymbolTop + 36;
+  for (unsigned int i=0; i<imagesize; i++) {
+    object *obj = &Workspace[i];
+    if (!blockp(obj)) continue;
+    vector_t *v = (vector_t *)cdr(obj);
+    bytesneeded = bytesneeded + 8 + (v->bytes ? v->length : v->length*4);
+  }
   if (bytesneeded > EEPROMSIZE) error(SAVEIMAGE, PSTR("image size too large"), number(imagesize));
   EEPROM.begin(EEPROMSIZE);
   int addr = 0;
@@ -590,15 +976,22 @@ unsigned int saveimage (object *arg) {
   EpromWriteInt(&addr, imagesize);
   EpromWriteInt(&addr, (uintptr_t)GlobalEnv);
   EpromWriteInt(&addr, (uintptr_t)GCStack);
-  #if SYMBOLTABLESIZE > BUFFERSIZE
-  EpromWriteInt(&addr, (uintptr_t)SymbolTop);
-  for (int i=0; i<SYMBOLTABLESIZE; i++) EEPROM.write(addr++, SymbolTable[i]);
-  #endif
+  EpromWriteInt(&addr, SymbolTop);
+  for (unsigned int i=0; i<SymbolTop; i++) EEPROM.write(addr++, SymbolTable[i]);
   for (unsigned int i=0; i<imagesize; i++) {
     object *obj = &Workspace[i];
     EpromWriteInt(&addr, (uintptr_t)car(obj));
     EpromWriteInt(&addr, (uintptr_t)cdr(obj));
   }
+  for (unsigned int i=0; i<imagesize; i++) {
+    object *obj = &Workspace[i];
+    if (!blockp(obj)) continue;
+    vector_t *v = (vector_t *)cdr(obj);
+    EpromWriteInt(&addr, v->length);
+    EpromWriteInt(&addr, v->bytes);
+    if (v->bytes) for (unsigned int k=0; k<v->length; k++) EEPROM.write(addr++, ((uint8_t *)(v + 1))[k]);
+    else for (unsigned int k=0; k<v->length; k++) EpromWriteInt(&addr, (uintptr_t)((object **)(v + 1))[k]);
+  }
   EEPROM.commit();
   return imagesize;
 #else
@@ -620,10 +1013,8 @@ unsigned int saveimage (object *arg) {
   SpiffsWriteInt(file, imagesize);
   SpiffsWriteInt(file, (uintptr_t)GlobalEnv);
   SpiffsWriteInt(file, (uintptr_t)GCStack);
-  #if SYMBOLTABLESIZE > BUFFERSIZE
-  SpiffsWriteInt(file, (uintptr_t)SymbolTop);
-  for (int i=0; i<SYMBOLTABLESIZE; i++) file.write(SymbolTable[i]);
-  #endif
+  SpiffsWriteInt(file, SymbolTop);
+  for (unsigned int i=0; i<SymbolTop; i++) file.write(SymbolTable[i]);
   for (int i=0; i<NUMPAGESRESIDENT; i++) {
     for (int j=0; j<PAGESIZE; j++) {
       object *obj = &PageBuffer[i][j];
@@ -631,6 +1022,17 @@ unsigned int saveimage (object *arg) {
       SpiffsWriteInt(file, (uintptr_t)cdr(obj));
     }
   }
+  for (int i=0; i<NUMPAGESRESIDENT; i++) {
+    for (int j=0; j<PAGESIZE; j++) {
+      object *obj = &PageBuffer[i][j];
+      if (!blockp(obj)) continue;
+      vector_t *v = (vector_t *)cdr(obj);
+      SpiffsWriteInt(file, v->length);
+      SpiffsWriteInt(file, v->bytes);
+      if (v->bytes) file.write((uint8_t *)(v + 1), v->length);
+      else for (unsigned int k=0; k<v->length; k++) SpiffsWriteInt(file, (uintptr_t)((object **)(v + 1))[k]);
+    }
+  }
   file.close();
   return imagesize;
 #endif
@@ -668,17 +1070,28 @@ unsigned int loadimage (object *arg) {
   int imagesize = SDReadInt(file);
   GlobalEnv = (object *)SDReadInt(file);
   GCStack = (object *)SDReadInt(file);
-  #if SYMBOLTABLESIZE > BUFFERSIZE
-  SymbolTop = (char *)SDReadInt(file);
-  for (int i=0; i<SYMBOLTABLESIZE; i++) SymbolTable[i] = file.read();
-  #endif
+  unsigned int top = SDReadInt(file);
+  SymbolTop = 0; growsymbols(top);
+  for (unsigned int i=0; i<top; i++) SymbolTable[i] = file.read();
+  SymbolTop = top; indexsymbols();
+  forgetblocks(true);
   for (int i=0; i<imagesize; i++) {
     object *obj = &Workspace[i];
     car(obj) = (object *)SDReadInt(file);
     cdr(obj) = (object *)SDReadInt(file);
   }
+  forgetblocks(false);
+  for (int i=0; i<imagesize; i++) {
+    object *obj = &Workspace[i];
+    if (!blockp(obj)) continue;
+    int length = SDReadInt(file);
+    vector_t *v = loadblock(obj, length, SDReadInt(file));
+    if (v->bytes) file.read((uint8_t *)(v + 1), length);
+    else for (int k=0; k<length; k++) ((object **)(v + 1))[k] = (object *)SDReadInt(file);
+  }
   file.close();
   gc(NULL, NULL);
+  indexglobals();
   return imagesize;
 #elif defined(eepromsupport)
   EEPROM.begin(EEPROMSIZE);
@@ -688,16 +1101,27 @@ unsigned int loadimage (object *arg) {
   if (imagesize == 0 || imagesize == 0xFFFF) error2(LOADIMAGE, PSTR("no saved image"));
   GlobalEnv = (object *)EpromReadInt(&addr);
   GCStack = (object *)EpromReadInt(&addr);
-  #if SYMBOLTABLESIZE > BUFFERSIZE
-  SymbolTop = (char *)EpromReadInt(&addr);
-  for (int i=0; i<SYMBOLTABLESIZE; i++) SymbolTable[i] = EEPROM.read(addr++);
-  #endif
+  unsigned int top = EpromReadInt(&addr);
+  SymbolTop = 0; growsymbols(top);
+  for (unsigned int i=0; i<top; i++) SymbolTable[i] = EEPROM.read(addr++);
+  SymbolTop = top; indexsymbols();
+  forgetblocks(true);
   for (int i=0; i<imagesize; i++) {
     object *obj = &Workspace[i];
     car(obj) = (object *)EpromReadInt(&addr);
     cdr(obj) = (object *)EpromReadInt(&addr);
   }
+  forgetblocks(false);
+  for (int i=0; i<imagesize; i++) {
+    object *obj = &Workspace[i];
+    if (!blockp(obj)) continue;
+    int length = EpromReadInt(&addr);
+    vector_t *v = loadblock(obj, length, EpromReadInt(&addr));
+    if (v->bytes) for (int k=0; k<length; k++) ((uint8_t *)(v + 1))[k] = EEPROM.read(addr++);
+    else for (int k=0; k<length; k++) ((object **)(v + 1))[k] = (object *)EpromReadInt(&addr);
+  }
   gc(NULL, NULL);
+  indexglobals();
   return imagesize;
 #else
   SPIFFS.begin();
@@ -710,10 +1134,11 @@ unsigned int loadimage (object *arg) {
   int imagesize = SpiffsReadInt(file);
   GlobalEnv = (object *)SpiffsReadInt(file);
   GCStack = (object *)SpiffsReadInt(file);
-  #if SYMBOLTABLESIZE > BUFFERSIZE
-  SymbolTop = (char *)SpiffsReadInt(file);
-  for (int i=0; i<SYMBOLTABLESIZE; i++) SymbolTable[i] = file.read();
-  #endif
+  unsigned int top = SpiffsReadInt(file);
+  SymbolTop = 0; growsymbols(top);
+  for (unsigned int i=0; i<top; i++) SymbolTable[i] = file.read();
+  SymbolTop = top; indexsymbols();
+  forgetblocks(true);
   for (int i=0; i<NUMPAGESRESIDENT; i++) {
     for (int j=0; j<PAGESIZE; j++) {
       object *obj = &PageBuffer[i][j];
@@ -721,8 +1146,20 @@ unsigned int loadimage (object *arg) {
       cdr(obj) = (object *)SpiffsReadInt(file);
     }
   }
+  forgetblocks(false);
+  for (int i=0; i<NUMPAGESRESIDENT; i++) {
+    for (int j=0; j<PAGESIZE; j++) {
+      object *obj = &PageBuffer[i][j];
+      if (!blockp(obj)) continue;
+      int length = SpiffsReadInt(file);
+      vector_t *v = loadblock(obj, length, SpiffsReadInt(file));
+      if (v->bytes) file.read((uint8_t *)(v + 1), length);
+      else for (int k=0; k<length; k++) ((object **)(v + 1))[k] = (object *)SpiffsReadInt(file);
+    }
+  }
   file.close();
   gc(NULL, NULL);
+  indexglobals();
   return imagesize;
 #endif
 }
@@ -762,6 +1199,10 @@ void autorunimage () {
 // Error handling
 
 void errorsub (symbol_t fname, PGM_P string) {
+  setflag(PRINTREADABLY); // In case the error interrupted princ
+  clrflag(RETURNFLAG); // In case the error interrupted a return
+  clrflag(NOGC); // In case the error interrupted a benchmark
+  Expansions = NULL; // In case the error interrupted a macro expansion
   pfl(pserial); pfstring(PSTR("Error: "), pserial);
   if (fname) {
     pserial('\''); 
@@ -776,6 +1217,7 @@ void error (symbol_t fname, PGM_P string, object *symbol) {
   pfstring(PSTR(": "), pserial); printobject(symbol, pserial);
   pln(pserial);
   GCStack = NULL;
+  StackTop = 0; FrameTop = 0;
   longjmp(exception, 1);
 }
 
@@ -783,6 +1225,7 @@ void error2 (symbol_t fname, PGM_P string) {
   errorsub(fname, string);
   pln(pserial);
   GCStack = NULL;
+  StackTop = 0; FrameTop = 0;
   longjmp(exception, 1);
 }
 
@@ -791,6 +1234,7 @@ const char notanumber[] PROGMEM = "argument is not a number";
 const char notastring[] PROGMEM = "argument is not a string";
 const char notalist[] PROGMEM = "argument is not a list";
 const char notproper[] PROGMEM = "argument is not a proper list";
+const char notavector[] PROGMEM = "argument is not a vector";
 const char noargument[] PROGMEM = "missing argument";
 const char nostream[] PROGMEM = "missing stream argument";
 const char overflow[] PROGMEM = "arithmetic overflow";
@@ -847,6 +1291,18 @@ boolean listp (object *x) {
   return type >= PAIR || type == ZERO;
 }
 
+boolean localp (object *x) {
+  return consp(x) && car(x) != NULL && car(x)->type == LOCAL;
+}
+
+boolean callsitep (object *x) {
+  return consp(x) && car(x) != NULL && car(x)->type == CALLSITE;
+}
+
+boolean typedp (object *x) {
+  return consp(x) && car(x) != NULL && car(x)->type == TYPED;
+}
+
 boolean improperp (object *x) {
   if (x == NULL) return false;
   unsigned int type = x->type;
@@ -867,12 +1323,24 @@ int fromradix40 (int n) {
   return 0;
 }
 
-int pack40 (char *buffer) {
-  return (((toradix40(buffer[0]) * 40) + toradix40(buffer[1])) * 40 + toradix40(buffer[2]));
+// Up to six characters packed left-aligned, so every packed name is >= 40^5
+
+symbol_t pack40 (char *buffer) {
+  symbol_t x = 0;
+  for (int i=0; i<6; i++) {
+    x = x * 40 + toradix40(*buffer);
+    if (*buffer != 0) buffer++;
+  }
+  return x;
 }
 
 boolean valid40 (char *buffer) {
- return (toradix40(buffer[0]) >= 0 && toradix40(buffer[1]) >= 0 && toradix40(buffer[2]) >= 0);
+  for (int i=0; i<6; i++) {
+    if (*buffer == 0) return true;
+    if (toradix40(*buffer) < 0) return false;
+    buffer++;
+  }
+  return (*buffer == 0);
 }
 
 int digitvalue (char d) {
@@ -884,21 +1352,50 @@ int digitvalue (char d) {
 
 char *symbolname (symbol_t x) {
   if (x < ENDFUNCTIONS) return lookupbuiltin(x);
-  else if (x >= 64000) return lookupsymbol(x);
-  char *buffer = SymbolTop;
-  buffer[3] = '\0';
-  for (int n=2; n>=0; n--) {
+  else if (x < PACKED40) return lookupsymbol(x);
+  char *buffer = Scratch;
+  buffer[6] = '\0';
+  for (int n=5; n>=0; n--) {
     buffer[n] = fromradix40(x % 40);
     x = x / 40;
   }
   return buffer;
 }
 
+// Keywords such as :start evaluate to themselves, and never pack into radix 40
+
+boolean keywordp (object *obj) {
+  if (!symbolp(obj)) return false;
+  symbol_t name = obj->name;
+  return name >= ENDFUNCTIONS && name < PACKED40 && lookupsymbol(name)[0] == ':';
+}
+
+// Sets values[i] to the argument after keys[i] in a keyword argument list, or to NULL if it's absent
+
+void keywordargs (symbol_t name, object *args, const char *const keys[], object *values[], int n) {
+  for (int i=0; i<n; i++) values[i] = NULL;
+  while (args != NULL) {
+    object *key = first(args);
+    if (cdr(args) == NULL) error(name, PSTR("missing value for keyword"), key);
+    int i = 0;
+    while (i < n && !(keywordp(key) && strcmp(symbolname(key->name), keys[i]) == 0)) i++;
+    if (i == n) error(name, PSTR("unknown keyword"), key);
+    values[i] = second(args);
+    args = cddr(args);
+  }
+}
+
 int checkinteger (symbol_t name, object *obj) {
   if (!integerp(obj)) error(name, PSTR("argument is not an integer"), obj);
   return obj->integer;
 }
 
+int checkbyte (symbol_t name, object *obj) {
+  int byte = checkinteger(name, obj);
+  if (byte < 0 || byte > 255) error(name, PSTR("argument is not a byte"), obj);
+  return byte;
+}
+
 float checkintfloat (symbol_t name, object *obj){
   if (integerp(obj)) return obj->integer;
   if (floatp(obj)) return obj->single_float;
@@ -919,6 +1416,14 @@ int issymbol (object *obj, symbol_t n) {
   return symbolp(obj) && obj->name == n;
 }
 
+boolean lambdap (object *x) {
+  return consp(x) && (issymbol(car(x), LAMBDA) || codep(car(x)));
+}
+
+boolean macrop (object *x) {
+  return consp(x) && issymbol(car(x), MACRO);
+}
+
 void checkargs (symbol_t name, object *args) {
   int nargs = listlength(name, args);
   if (name >= ENDFUNCTIONS) error(0, PSTR("not valid here"), symbol(name));
@@ -982,42 +1487,40 @@ void indent (int spaces, pfun_t pfun) {
   for (int i=0; i<spaces; i++) pfun(' ');
 }
 
-void buildstring (char ch, int *chars, object **head) {
-  static object* tail;
-  static uint8_t shift;
-  if (*chars == 0) {
-    shift = (sizeof(int)-1)*8;
-    *chars = ch<<shift;
+// Packs sizeof(int) characters into each cell, first character in the top byte
+
+object *chainstring (const char *chars, int length) {
+  object *head = NULL, *tail = NULL;
+  for (int i=0; i<length; i=i+sizeof(int)) {
+    int quad = 0;
+    for (int j=0; j<(int)sizeof(int); j++) {
+      quad = quad<<8;
+      if (i+j < length) quad = quad | (uint8_t)chars[i+j];
+    }
     object *cell = myalloc();
-    if (*head == NULL) *head = cell; else tail->car = cell;
     cell->car = NULL;
-    cell->integer = *chars;
+    cell->integer = quad;
+    if (head == NULL) head = cell; else tail->car = cell;
     tail = cell;
-  } else {
-    shift = shift - 8;
-    *chars = *chars | ch<<shift;
-    tail->integer = *chars;
-    if (shift == 0) *chars = 0;
   }
+  return head;
 }
 
 object *readstring (char delim, gfun_t gfun) {
-  object *obj = myalloc();
-  obj->type = STRING;
   int ch = gfun();
   if (ch == -1) return nil;
-  object *head = NULL;
-  int chars = 0;
+  builder_t b;
+  startstring(0, &b, 0);
   while ((ch != delim) && (ch != -1)) {
     if (ch == '\\') ch = gfun();
-    buildstring(ch, &chars, &head);
+    appendchar(&b, ch);
     ch = gfun();
   }
-  obj->cdr = head;
-  return obj;
+  return finishstring(&b);
 }
 
 int stringlength (object *form) {
+  if (form->type == LONGSTRING) return vectorlength(form);
   int length = 0;
   form = cdr(form);
   while (form != NULL) {
@@ -1031,6 +1534,7 @@ int stringlength (object *form) {
 }
 
 char nthchar (object *string, int n) {
+  if (string->type == LONGSTRING) return (n >= 0 && n < stringlength(string)) ? stringchars(string)[n] : 0;
   object *arg = cdr(string);
   int top;
   if (sizeof(int) == 4) { top = n>>2; n = 3 - (n&3); }
@@ -1044,11 +1548,17 @@ char nthchar (object *string, int n) {
 }
 
 char *cstringbuf (object *arg) {
-  cstring(arg, SymbolTop, SYMBOLTABLESIZE-(SymbolTop-SymbolTable));
-  return SymbolTop;
+  return cstring(arg, Scratch, SCRATCHSIZE);
 }
 
 char *cstring (object *form, char *buffer, int buflen) {
+  if (form->type == LONGSTRING) {
+    int length = stringlength(form);
+    if (length >= buflen) error2(0, PSTR("no room for string"));
+    memcpy(buffer, stringchars(form), length);
+    buffer[length] = '\0';
+    return buffer;
+  }
   int index = 0;
   form = cdr(form);
   while (form != NULL) {
@@ -1066,19 +1576,26 @@ char *cstring (object *form, char *buffer, int buflen) {
   return buffer;
 }
 
-object *lispstring (char *s) {
+// A string of up to SHORTSTRING characters is a chain of cells, and a longer one is contiguous
+
+object *makestring (symbol_t name, const char *s, int length) {
+  if (length > SHORTSTRING) return makelongstring(name, s, length);
   object *obj = myalloc();
   obj->type = STRING;
+  obj->cdr = chainstring(s, length);
+  return obj;
+}
+
+object *lispstring (char *s) {
+  builder_t b;
+  startstring(0, &b, strlen(s));
   char ch = *s++;
-  object *head = NULL;
-  int chars = 0;
   while (ch) {
     if (ch == '\\') ch = *s++;
-    buildstring(ch, &chars, &head);
+    appendchar(&b, ch);
     ch = *s++;
   }
-  obj->cdr = head;
-  return obj;
+  return finishstring(&b);
 }
 
 // Lookup variable in environment
@@ -1092,17 +1609,768 @@ object *value (symbol_t n, object *env) {
   return nil;
 }
 
+// Global bindings stay on the GlobalEnv alist, with a hash index from symbol name to pair
+
+object *globalvalue (symbol_t n) {
+  if (GlobalIndexSize == 0) return nil;
+  unsigned int i = hashslot(n, GlobalIndexSize);
+  while (GlobalIndex[i] != NULL) {
+    if (car(GlobalIndex[i])->name == n) return GlobalIndex[i];
+    i = nextslot(i, GlobalIndexSize);
+  }
+  return nil;
+}
+
+void indexglobal (object *pair) {
+  unsigned int i = hashslot(car(pair)->name, GlobalIndexSize);
+  while (GlobalIndex[i] != NULL) i = nextslot(i, GlobalIndexSize);
+  GlobalIndex[i] = pair;
+}
+
+void indexglobals () {
+  unsigned int count = listlength(0, GlobalEnv);
+  unsigned int size = tablesize(count, 64);
+  GlobalIndex = (object **)cleartable(GlobalIndex, size, sizeof(object *), PSTR("no room for globals"));
+  GlobalIndexSize = size;
+  GlobalEpoch++;
+  FoldToken = NULL;
+  // Newest first, so an older duplicate binding stays shadowed
+  object *globals = GlobalEnv;
+  while (globals != NULL) {
+    object *pair = first(globals);
+    if (globalvalue(car(pair)->name) == NULL) indexglobal(pair);
+    globals = cdr(globals);
+  }
+  GlobalCount = count;
+}
+
+object *defglobal (object *var, object *val) {
+  object *pair = globalvalue(var->name);
+  if (pair != NULL) {
+    if (macrop(cdr(pair)) || macrop(val)) FoldToken = NULL; // Expanded calls are out of date
+    cdr(pair) = val;
+    return pair;
+  }
+  if (tablefull(GlobalCount, GlobalIndexSize)) indexglobals();
+  pair = cons(var, val);
+  push(pair, GlobalEnv);
+  indexglobal(pair);
+  GlobalCount++;
+  GlobalEpoch++;
+  if (var->name < ENDFUNCTIONS) FoldToken = NULL;
+  return pair;
+}
+
+// Names that have been bound locally, as a local binding can hide a global from the functions it calls.
+// The set is exact, so binding one name never stops calls to another from being cached
+
+boolean localname (symbol_t name) {
+  if (LocalNamesSize == 0) return false;
+  unsigned int i = hashslot(name, LocalNamesSize);
+  while (LocalNames[i] != NIL) {
+    if (LocalNames[i] == name) return true;
+    i = nextslot(i, LocalNamesSize);
+  }
+  return false;
+}
+
+void addlocalname (symbol_t name) {
+  unsigned int i = hashslot(name, LocalNamesSize);
+  while (LocalNames[i] != NIL) i = nextslot(i, LocalNamesSize);
+  LocalNames[i] = name;
+  LocalNamesCount++;
+}
+
+void notelocal (object *var) {
+  if (!symbolp(var) || var->name == NIL || localname(var->name)) return;
+  if (tablefull(LocalNamesCount, LocalNamesSize)) {
+    // NIL is 0, so it marks an empty slot
+    unsigned int size = tablesize(LocalNamesCount, LOCALNAMESSIZE);
+    symbol_t *old = LocalNames;
+    unsigned int oldsize = LocalNamesSize;
+    LocalNames = (symbol_t *)cleartable(NULL, size, sizeof(symbol_t), PSTR("no room for locals"));
+    LocalNamesSize = size; LocalNamesCount = 0;
+    for (unsigned int i=0; i<oldsize; i++) if (old[i] != NIL) addlocalname(old[i]);
+    free(old);
+  }
+  addlocalname(var->name);
+  GlobalEpoch++;
+  FoldToken = NULL;
+}
+
+object *localbinding (object *var, object *val) {
+  notelocal(var);
+  return cons(var, val);
+}
+
 object *findvalue (object *var, object *env) {
+  if (localp(var)) return local(var, env);
   symbol_t varname = var->name;
   object *pair = value(varname, env);
-  if (pair == NULL) pair = value(varname, GlobalEnv);
+  if (pair == NULL) pair = globalvalue(varname);
   if (pair == NULL) error(0, PSTR("unknown variable"), var);
   return pair;
 }
 
+// Lexical addressing
+
+/*
+  A function body is analysed the first time the function is called. Each reference to a
+  variable bound by the parameters, or by a let, let*, dolist, or dotimes inside the body,
+  becomes a local reference (tag . symbol), where the tag gives the number of bindings
+  that will be above it in env. Other symbols stay as they are and are looked up by name.
+  The analysed body is kept in a code object, which replaces lambda at the head of the function.
+
+  A lambda inside the body captures just the variables it uses from the enclosing scope. They
+  are recorded in its code object while its body is analysed, and a closure made from it holds
+  only those bindings, pushed below the parameters in the same order.
+
+  A call to a function named by any other symbol becomes a call site (tag symbol . target), where
+  the target is the global binding or builtin that the symbol named when the tag's epoch was
+  GlobalEpoch. GlobalEpoch changes when a global is added or removed, or a name is first bound
+  locally, so until then a call can skip looking the symbol up.
+
+  A call to a global macro is expanded when the body is analysed, and the expansion is analysed
+  in its place, so the macro is only expanded once. As the expander can run the garbage collector,
+  the calls are expanded after an analysis that finds them, and the body is analysed again with
+  the expansions. Code with expansions keeps the FoldToken like folded code below, and defining a
+  macro replaces the token, so the calls are expanded again if a macro is redefined.
+
+  A call to a pure builtin with constant arguments is replaced by its result, and an if, when,
+  unless, or cond with a constant test by the branch it would take. Code folded like this keeps
+  the FoldToken current when it was analysed, and is analysed again if the token has been
+  replaced, because a builtin may have been redefined or bound locally since.
+*/
+
+object *local (object *ref, object *env) {
+  int hops = car(ref)->integer;
+  symbol_t name = cdr(ref)->name;
+  object *list = env;
+  while (list != NULL) {
+    object *pair = car(list);
+    if (pair != NULL) {
+      if (hops == 0) {
+        if (car(pair)->name == name) return pair;
+        break;
+      }
+      hops--;
+    }
+    list = cdr(list);
+  }
+  // Not where the analysis expected, so search by name
+  return findvalue(cdr(ref), env);
+}
+
+object *callsite (object *site, object *env) {
+  object *tag = car(site), *var = second(site);
+  if (tag->integer == (int)GlobalEpoch) {
+    object *target = cddr(site);
+    return consp(target) ? cdr(target) : target;
+  }
+  symbol_t name = var->name;
+  object *pair = localname(name) ? value(name, env) : NULL;
+  if (pair != NULL) return cdr(pair);
+  pair = globalvalue(name);
+  if (pair == NULL && name > ENDFUNCTIONS && !keywordp(var)) error(0, PSTR("undefined"), var);
+  // Only cache it if no local binding could hide it
+  if (!localname(name)) {
+    cddr(site) = (pair != NULL) ? pair : var;
+    tag->integer = GlobalEpoch;
+  }
+  return (pair != NULL) ? cdr(pair) : var;
+}
+
+// Calls an arithmetic function on two arguments declared as fixnums, or as floats with TYPEDFLOAT;
+// with safety 0 the types aren't checked and fixnum results wrap around
+
+object *typedcall (int kind, symbol_t op, object *a, object *b) {
+  if (!(kind & UNCHECKED)) {
+    object *array[2] = { a, b };
+    return lookupfixed(op)(array, NULL);
+  }
+  if (kind & TYPEDFLOAT) {
+    float x = a->single_float, y = b->single_float;
+    switch (op) {
+      case ADD: return makefloat(x + y);
+      case SUBTRACT: return makefloat(x - y);
+      case MULTIPLY: return makefloat(x * y);
+      case NUMEQ: return (x == y) ? tee : nil;
+      case NOTEQ: return (x != y) ? tee : nil;
+      case LESS: return (x < y) ? tee : nil;
+      case LESSEQ: return (x <= y) ? tee : nil;
+      case GREATER: return (x > y) ? tee : nil;
+      default: return (x >= y) ? tee : nil;
+    }
+  }
+  unsigned int x = a->integer, y = b->integer;
+  switch (op) {
+    case ADD: return number(x + y);
+    case SUBTRACT: return number(x - y);
+    case MULTIPLY: return number(x * y);
+    case NUMEQ: return (x == y) ? tee : nil;
+    case NOTEQ: return (x != y) ? tee : nil;
+    case LESS: return ((int)x < (int)y) ? tee : nil;
+    case LESSEQ: return ((int)x <= (int)y) ? tee : nil;
+    case GREATER: return ((int)x > (int)y) ? tee : nil;
+    default: return ((int)x >= (int)y) ? tee : nil;
+  }
+}
+
+inline object *typedarg (object *arg, object *env) {
+  return localp(arg) ? cdr(local(arg, env)) : arg;
+}
+
+// A typed call is (tag op arg1 arg2), where each argument is a local reference or a constant
+
+object *typedform (object *form, object *env) {
+  object *args = cddr(form);
+  return typedcall(car(form)->integer, second(form)->name, typedarg(first(args), env), typedarg(second(args), env));
+}
+
+inline object *codesource (object *code) {
+  return first(cdr(code));
+}
+
+inline object *codebody (object *code) {
+  return second(cdr(code));
+}
+
+inline object *codecaptures (object *code) {
+  return third(cdr(code));
+}
+
+inline object *codefolds (object *code) {
+  return third(cddr(code));
+}
+
+inline object *codeparams (object *code) {
+  return third(cdr(cddr(code)));
+}
+
+object *analyse (object *form, object *scope);
+
+// Returns the original list if the analysed copy has the same elements, so unchanged code is shared
+
+object *shared (object *copy, object *list) {
+  object *a = copy, *b = list;
+  while (consp(a) && consp(b)) {
+    if (car(a) != car(b)) return copy;
+    a = cdr(a); b = cdr(b);
+  }
+  return (a == b) ? list : copy;
+}
+
+// Returns the number of bindings above var in env at run time, or -1 if it isn't lexically bound.
+// A lambda's scope ends in a frame (captures . outer), and a variable found in outer is captured
+
+int scopeindex (object *var, object *scope) {
+  int hops = 0;
+  while (scope != NULL) {
+    object *item = first(scope);
+    if (consp(item)) {
+      object *captures = car(item), *last = NULL;
+      while (captures != NULL) {
+        object *ref = first(captures);
+        if ((localp(ref) ? cdr(ref) : ref)->name == var->name) return hops;
+        hops++;
+        last = captures;
+        captures = cdr(captures);
+      }
+      int outer = scopeindex(var, cdr(item));
+      if (outer < 0) return -1;
+      object *cell = cons((outer < MAXHOPS) ? cons(&LocalTags[outer], var) : var, NULL);
+      if (last == NULL) car(item) = cell; else cdr(last) = cell;
+      return hops;
+    }
+    if (item != NULL && item->name == var->name) return hops;
+    hops++;
+    scope = cdr(scope);
+  }
+  return -1;
+}
+
+object *analyseref (object *var, object *scope) {
+  if (!symbolp(var)) return var;
+  int hops = scopeindex(var, scope);
+  if (hops < 0 || hops >= MAXHOPS) return var;
+  return cons(&LocalTags[hops], var);
+}
+
+object *globalmacro (object *function) {
+  object *pair = globalvalue(function->name);
+  return (pair != NULL && macrop(cdr(pair))) ? cdr(pair) : NULL;
+}
+
+// Analyses the expansion of a macro call if lambdacode has made it, or notes that it's needed;
+// the expander isn't run here, as the garbage collector could free the partly analysed code
+
+object *analysemacro (object *form, object *scope) {
+  Folded = true; // So it's expanded again if the macro is redefined
+  for (object *list = Expansions; list != NULL; list = cdr(list)) {
+    if (car(first(list)) == form) return analyse(cdr(first(list)), scope);
+  }
+  push(form, Unexpanded);
+  return form;
+}
+
+object *analysecall (object *function, object *scope) {
+  object *ref = analyseref(function, scope);
+  if (!symbolp(ref)) return ref;
+  object *tag = myalloc();
+  tag->type = CALLSITE;
+  tag->integer = 0; // Not yet looked up
+  return cons(tag, cons(ref, NULL));
+}
+
+object *analyselist (object *forms, object *scope) {
+  object *head = NULL, *tail = NULL, *list = forms;
+  while (consp(list)) {
+    object *cell = cons(analyse(car(list), scope), NULL);
+    if (head == NULL) head = cell; else cdr(tail) = cell;
+    tail = cell;
+    list = cdr(list);
+  }
+  if (head == NULL) return forms;
+  cdr(tail) = list;
+  return shared(head, forms);
+}
+
+object *analyseplace (object *place, object *scope) {
+  if (consp(place)) return shared(cons(car(place), analyselist(cdr(place), scope)), place);
+  return analyseref(place, scope);
+}
+
+object *analysepairs (object *args, object *scope, boolean places) {
+  if (!consp(args) || !consp(cdr(args))) return args;
+  object *place = places ? analyseplace(first(args), scope) : analyseref(first(args), scope);
+  object *pairs = cons(place, cons(analyse(second(args), scope), analysepairs(cddr(args), scope, places)));
+  return shared(pairs, args);
+}
+
+// Type declarations
+
+boolean namedp (object *obj, const char *name) {
+  return symbolp(obj) && strcmp(symbolname(obj->name), name) == 0;
+}
+
+// Returns the part of scope starting with the innermost binding of var in this function, or NULL
+
+object *scopecell (object *var, object *scope) {
+  if (!symbolp(var)) return NULL;
+  while (scope != NULL) {
+    object *item = first(scope);
+    if (consp(item)) return NULL;
+    if (item != NULL && item->name == var->name) return scope;
+    scope = cdr(scope);
+  }
+  return NULL;
+}
+
+// Returns fixnum (0) or TYPEDFLOAT for an analysed argument of known type, or -1
+
+int argkind (object *arg, object *scope) {
+  if (integerp(arg)) return 0;
+  if (floatp(arg)) return TYPEDFLOAT;
+  if (!localp(arg)) return -1;
+  object *cell = scopecell(cdr(arg), scope);
+  if (cell == NULL) return -1;
+  for (object *list = Declared; list != NULL; list = cdr(list)) {
+    if (car(first(list)) == cell) return cdr(first(list))->integer;
+  }
+  return -1;
+}
+
+// Records the declarations at the start of a body, and returns the rest of it
+
+object *declarations (object *body, object *scope) {
+  while (consp(body) && consp(first(body)) && issymbol(first(first(body)), DECLARE)) {
+    for (object *specs = cdr(first(body)); consp(specs); specs = cdr(specs)) {
+      object *spec = first(specs);
+      if (!consp(spec)) continue;
+      object *type = first(spec), *vars = cdr(spec);
+      if (namedp(type, "optimize")) {
+        for (; consp(vars); vars = cdr(vars)) {
+          object *quality = first(vars);
+          if (consp(quality) && namedp(first(quality), "safety") && consp(cdr(quality)) && integerp(second(quality)))
+            Safety = second(quality)->integer;
+        }
+        continue;
+      }
+      if (namedp(type, "type") && consp(vars)) { type = first(vars); vars = cdr(vars); }
+      int kind;
+      if (namedp(type, "fixnum")) kind = 0;
+      else if (issymbol(type, FLOATFN)) kind = TYPEDFLOAT;
+      else continue;
+      for (; consp(vars); vars = cdr(vars)) {
+        object *cell = scopecell(first(vars), scope);
+        if (cell != NULL) push(cons(cell, number(kind)), Declared);
+      }
+    }
+    body = cdr(body);
+  }
+  return body;
+}
+
+// Returns a typed call if both arguments of an arithmetic function are declared, or are constants of the same type
+
+object *analysetyped (object *function, object *args, object *scope) {
+  symbol_t name = function->name;
+  if (Declared == NULL || !consp(args) || !consp(cdr(args)) || cddr(args) != NULL) return NULL;
+  if (name != ADD && name != SUBTRACT && name != MULTIPLY && (name < NOTEQ || name > GREATEREQ)) return NULL;
+  object *arg1 = first(args), *arg2 = second(args);
+  if (!localp(arg1) && !localp(arg2)) return NULL;
+  int kind = argkind(arg1, scope);
+  if (kind < 0 || argkind(arg2, scope) != kind) return NULL;
+  Folded = true; // So it's analysed again if the function is redefined
+  if (Safety == 0) kind = kind | UNCHECKED;
+  return cons(&TypedTags[kind], cons(function, args));
+}
+
+// Returns a descriptor (counts vars . defaults) for a lambda list, or nil if bind has to report it as invalid;
+// counts packs the number of required and optional parameters and whether there's a rest parameter
+
+object *lambdalist (object *params) {
+  object *vars = NULL, *defaults = NULL, *vtail = NULL, *dtail = NULL;
+  int required = 0, optional = 0, rest = 0;
+  boolean optionals = false;
+  while (params != NULL) {
+    if (!consp(params)) return nil;
+    object *var = first(params);
+    if (issymbol(var, OPTIONAL)) {
+      if (optionals) return nil;
+      optionals = true;
+      params = cdr(params);
+      continue;
+    }
+    if (issymbol(var, AMPREST)) {
+      params = cdr(params);
+      if (!consp(params) || cdr(params) != NULL) return nil;
+      var = first(params);
+      rest = 1;
+    } else if (optionals) {
+      object *cell = cons(nil, NULL);
+      if (consp(var)) {
+        if (consp(cdr(var))) car(cell) = second(var);
+        var = first(var);
+      }
+      if (defaults == NULL) defaults = cell; else cdr(dtail) = cell;
+      dtail = cell;
+      optional++;
+    } else required++;
+    if (!symbolp(var)) return nil;
+    object *cell = cons(var, NULL);
+    if (vars == NULL) vars = cell; else cdr(vtail) = cell;
+    vtail = cell;
+    params = cdr(params);
+  }
+  if (required > 255 || optional > 255) return nil;
+  return cons(number(required | optional<<8 | rest<<16), cons(vars, defaults));
+}
+
+object *analyselambda (object *function, object *scope) {
+  object *frame = cons(NULL, scope);
+  scope = cons(frame, NULL);
+  object *params = second(function);
+  while (consp(params)) {
+    object *var = first(params);
+    if (consp(var)) {
+      // Only for what it captures, as default values are evaluated by name
+      if (consp(cdr(var))) analyse(second(var), scope);
+      var = first(var);
+    }
+    if (!issymbol(var, OPTIONAL) && !issymbol(var, AMPREST)) push(symbolp(var) ? var : nil, scope);
+    params = cdr(params);
+  }
+  object *declared = Declared;
+  int safety = Safety;
+  object *body = analyselist(declarations(cddr(function), scope), scope);
+  Declared = declared; Safety = safety;
+  object *info = cons(car(frame), cons(NULL, cons(lambdalist(second(function)), NULL)));
+  if (Folded) {
+    if (FoldToken == NULL) FoldToken = cons(NULL, NULL);
+    second(info) = FoldToken;
+  }
+  #if defined(compiler)
+  cdr(cddr(info)) = cons(NULL, NULL); // Bytecode, compiled on the first call
+  #endif
+  object *code = myalloc();
+  code->type = CODE;
+  cdr(code) = cons(cdr(function), cons(body, info));
+  return code;
+}
+
+// Constant folding
+
+boolean constantp (object *form) {
+  return form == NULL || integerp(form) || floatp(form) || characterp(form) || stringp(form) ||
+    issymbol(form, NIL) || issymbol(form, TEE) || quoted(form);
+}
+
+object *constantvalue (object *form) {
+  if (quoted(form)) return second(form);
+  if (issymbol(form, NIL)) return nil;
+  return form;
+}
+
+object *literal (object *value) {
+  if (value == NULL || integerp(value) || floatp(value) || characterp(value) || issymbol(value, TEE)) return value;
+  return cons(symbol(QUOTE), cons(value, NULL));
+}
+
+// Returns true if builtin name can't fail or have side effects given these arguments
+
+boolean foldable (symbol_t name, object *values) {
+  boolean integers = false, nonzero = false;
+  switch (name) {
+    case NOT: case NULLFN: case NUMBERP: case INTEGERP: case FLOATP: return true;
+    case ADD: case SUBTRACT: case MULTIPLY: case ONEPLUS: case ONEMINUS: case ABS: case MAXFN: case MINFN:
+    case NOTEQ: case NUMEQ: case LESS: case LESSEQ: case GREATER: case GREATEREQ: case PLUSP: case MINUSP:
+    case ZEROP: case FLOATFN: case SIN: case COS: case TAN: case ASIN: case ACOS: case ATAN: case SINH:
+    case COSH: case TANH: case EXP: case SQRT: break;
+    case DIVIDE: case MOD: nonzero = true; break;
+    case ODDP: case EVENP: case LOGAND: case LOGIOR: case LOGXOR: case LOGNOT: case ASH: case LOGBITP:
+      integers = true; break;
+    default: return false;
+  }
+  while (values != NULL) {
+    object *arg = car(values);
+    if (!integerp(arg) && (integers || !floatp(arg))) return false;
+    if (nonzero && (integerp(arg) ? arg->integer == 0 : arg->single_float == 0.0)) return false;
+    values = cdr(values);
+  }
+  return true;
+}
+
+object *constantvalues (object *args, int n) {
+  object *head = NULL, *tail = NULL;
+  while (n-- > 0) {
+    object *cell = cons(constantvalue(car(args)), NULL);
+    if (head == NULL) head = cell; else cdr(tail) = cell;
+    tail = cell;
+    args = cdr(args);
+  }
+  return head;
+}
+
+// Replaces a call to a builtin with its result if the arguments are constants, or folds the
+// leading constant arguments of +, -, or *. Not if the builtin has been redefined or bound locally
+
+object *foldcall (object *form, object *scope) {
+  object *function = car(form);
+  object *args = analyselist(cdr(form), scope);
+  symbol_t name = function->name;
+  if (name < ENDFUNCTIONS && globalvalue(name) == NULL && !localname(name) && scopeindex(function, scope) < 0) {
+    int nargs = 0, constants = 0;
+    for (object *list = args; consp(list); list = cdr(list)) {
+      if (constants == nargs && constantp(car(list))) constants++;
+      nargs++;
+    }
+    if (constants == nargs && nargs >= lookupmin(name) && nargs <= lookupmax(name)) {
+      object *values = constantvalues(args, nargs);
+      if (foldable(name, values)) {
+        Folded = true;
+        return literal(callfn(name, values, NULL));
+      }
+    } else if ((name == ADD || name == SUBTRACT || name == MULTIPLY) && constants >= 2) {
+      object *values = constantvalues(args, constants);
+      if (foldable(name, values)) {
+        Folded = true;
+        object *rest = args;
+        for (int i=0; i<constants; i++) rest = cdr(rest);
+        args = cons(literal(callfn(name, values, NULL)), rest);
+      }
+    }
+    object *typed = analysetyped(function, args, scope);
+    if (typed != NULL) return typed;
+  }
+  return shared(cons(analysecall(function, scope), args), form);
+}
+
+object *progn (object *forms) {
+  if (forms == NULL) return nil;
+  if (cdr(forms) == NULL) return car(forms);
+  return cons(symbol(PROGN), forms);
+}
+
+// Replaces an if, when, unless, or cond whose test is a constant by the branch it would take
+
+object *foldtest (object *form, object *args) {
+  object *function = car(form);
+  symbol_t name = function->name;
+  if (name == COND) {
+    while (consp(args) && consp(car(args)) && constantp(car(car(args)))) {
+      object *clause = car(args);
+      if (constantvalue(car(clause)) != nil) {
+        if (cdr(clause) == NULL) break;
+        return progn(cdr(clause));
+      }
+      args = cdr(args);
+    }
+    return (args == NULL) ? nil : shared(cons(function, args), form);
+  }
+  if (!consp(args) || !constantp(first(args))) return shared(cons(function, args), form);
+  boolean test = (constantvalue(first(args)) != nil);
+  if (name == IF) {
+    if (!consp(cdr(args))) return shared(cons(function, args), form);
+    if (test) return second(args);
+    return consp(cddr(args)) ? third(args) : nil;
+  }
+  if (name == WHEN) return test ? progn(cdr(args)) : nil;
+  return test ? nil : progn(cdr(args));
+}
+
+object *analyselet (symbol_t name, object *args, object *scope) {
+  object *newscope = scope;
+  object *head = NULL, *tail = NULL;
+  object *assigns = first(args);
+  while (consp(assigns)) {
+    object *assign = car(assigns);
+    object *var = assign;
+    if (consp(assign)) {
+      var = first(assign);
+      if (consp(cdr(assign))) {
+        object *init = analyse(second(assign), (name == LETSTAR) ? newscope : scope);
+        assign = shared(cons(var, cons(init, cddr(assign))), assign);
+      }
+    }
+    push(symbolp(var) ? var : nil, newscope);
+    object *cell = cons(assign, NULL);
+    if (head == NULL) head = cell; else cdr(tail) = cell;
+    tail = cell;
+    assigns = cdr(assigns);
+  }
+  object *declared = Declared;
+  int safety = Safety;
+  object *body = analyselist(declarations(cdr(args), newscope), newscope);
+  Declared = declared; Safety = safety;
+  return cons(shared(head, first(args)), body);
+}
+
+object *analyseloop (object *args, object *scope) {
+  object *params = first(args);
+  if (!consp(params) || !consp(cdr(params))) return args;
+  object *var = first(params);
+  object *inner = cons(symbolp(var) ? var : nil, scope);
+  object *newparams = cons(var, cons(analyse(second(params), scope), analyselist(cddr(params), inner)));
+  return cons(shared(newparams, params), analyselist(cdr(args), inner));
+}
+
+object *analyseclauses (object *clauses, object *scope, boolean keys) {
+  object *head = NULL, *tail = NULL, *list = clauses;
+  while (consp(list)) {
+    object *clause = car(list);
+    if (consp(clause)) {
+      if (keys) clause = shared(cons(car(clause), analyselist(cdr(clause), scope)), clause);
+      else clause = analyselist(clause, scope);
+    }
+    object *cell = cons(clause, NULL);
+    if (head == NULL) head = cell; else cdr(tail) = cell;
+    tail = cell;
+    list = cdr(list);
+  }
+  return shared(head, clauses);
+}
+
+object *analyse (object *form, object *scope) {
+  if (symbolp(form)) return analyseref(form, scope);
+  if (!consp(form)) return form;
+  object *function = car(form);
+  object *args = cdr(form);
+  if (!listp(args)) return form;
+
+  if (symbolp(function)) {
+    symbol_t name = function->name;
+    if (name < FUNCTIONS && args == NULL) return form;
+    if (name == QUOTE && consp(args) && cdr(args) == NULL) {
+      object *arg = first(args);
+      if (arg == NULL || integerp(arg) || floatp(arg) || characterp(arg) || stringp(arg)) return arg;
+    }
+    if (name == LAMBDA) return cons(analyselambda(form, scope), args);
+    if (name == LET || name == LETSTAR) args = analyselet(name, args, scope);
+    else if (name == DOLIST || name == DOTIMES) args = analyseloop(args, scope);
+    else if (name == SETQ) args = analysepairs(args, scope, false);
+    else if (name == SETF) args = analysepairs(args, scope, true);
+    else if (name == PUSH && consp(cdr(args)))
+      args = cons(analyse(first(args), scope), cons(analyseplace(second(args), scope), cddr(args)));
+    else if (name == POP) args = cons(analyseplace(first(args), scope), cdr(args));
+    else if (name == INCF || name == DECF) args = cons(analyseplace(first(args), scope), analyselist(cdr(args), scope));
+    else if (name == DEFVAR || name == FORMILLIS) args = cons(first(args), analyselist(cdr(args), scope));
+    else if (name == COND) args = analyseclauses(args, scope, false);
+    else if (name == CASE) args = cons(analyse(first(args), scope), analyseclauses(cdr(args), scope, true));
+    else if (name == LOOP || name == RETURN || (name > TAIL_FORMS && name < FUNCTIONS)) args = analyselist(args, scope);
+    else if (name < FUNCTIONS) return form; // Leave other special forms as they are
+    else if (globalmacro(function) != NULL && scopeindex(function, scope) < 0)
+      return analysemacro(form, scope);
+    else return foldcall(form, scope);
+    if (name == IF || name == WHEN || name == UNLESS || name == COND) return foldtest(form, args);
+    return shared(cons(function, args), form);
+  }
+  return shared(cons(analyse(function, scope), analyselist(args, scope)), form);
+}
+
+// Returns the code object for a function, analysing it if this is its first call
+
+object *lambdacode (object *function) {
+  object *code = car(function);
+  if (codep(code) && codesource(code) == cdr(function)) {
+    object *folds = codefolds(code);
+    if (folds == NULL || folds == FoldToken) return code;
+  }
+  boolean folded = Folded;
+  object *declared = Declared, *expansions = Expansions;
+  int safety = Safety;
+  push(expansions, GCStack);
+  push(function, GCStack);
+  Expansions = NULL;
+  for (;;) {
+    Folded = false; Declared = NULL; Safety = 1; Unexpanded = NULL;
+    code = analyselambda(function, NULL);
+    if (Unexpanded == NULL) break;
+    // Expand the macro calls, and analyse the function again with the expansions in place
+    push(Unexpanded, GCStack);
+    for (object *calls = Unexpanded; calls != NULL; calls = cdr(calls)) {
+      object *call = first(calls), *macro = globalmacro(first(call));
+      if (macro != NULL) push(cons(call, apply(first(call)->name, cdr(macro), cdr(call), NULL)), Expansions);
+    }
+    pop(GCStack);
+  }
+  Expansions = expansions;
+  pop(GCStack); pop(GCStack);
+  Folded = folded; Declared = declared; Safety = safety;
+  car(function) = code;
+  return code;
+}
+
 // Handling closures
-  
-object *closure (int tc, symbol_t name, object *state, object *function, object *args, object **env) {
+
+void tracereturn (int trace, symbol_t name, object *result) {
+  indent((--(TraceDepth[trace-1]))<<1, pserial);
+  pint(TraceDepth[trace-1], pserial);
+  pserial(':'); pserial(' ');
+  pstring(symbolname(name), pserial); pfstring(PSTR(" returned "), pserial);
+  printobject(result, pserial); pln(pserial);
+}
+
+object *makeclosure (object *function, object *env) {
+  if (env == NULL) return function;
+  object *envcopy = NULL;
+  if (codep(car(function))) {
+    object *captures = codecaptures(car(function));
+    while (captures != NULL) {
+      push(findvalue(first(captures), env), envcopy);
+      captures = cdr(captures);
+    }
+  } else {
+    while (env != NULL) {
+      object *pair = first(env);
+      if (pair != NULL) push(pair, envcopy);
+      env = cdr(env);
+    }
+  }
+  return cons(symbol(CLOSURE), cons(envcopy, function));
+}
+
+void bind (int tc, symbol_t name, object *state, object *function, object *args, object **env) {
   int trace = 0;
   if (name) trace = tracing(name);
   if (trace) {
@@ -1110,8 +2378,7 @@ object *closure (int tc, symbol_t name, object *state, object *function, object
     pint(TraceDepth[trace-1]++, pserial);
     pserial(':'); pserial(' '); pserial('('); pstring(symbolname(name), pserial);
   }
-  object *params = first(function);
-  function = cdr(function);
+  object *params = second(function);
   // Dropframe
   if (tc) {
     if (*env != NULL && car(*env) == NULL) {
@@ -1122,10 +2389,47 @@ object *closure (int tc, symbol_t name, object *state, object *function, object
   // Push state
   while (state != NULL) {
     object *pair = first(state);
+    notelocal(car(pair)); // In case it was bound before an image was loaded
     push(pair, *env);
     state = cdr(state);
   }
-  // Add arguments to environment
+  // Add arguments to environment, using the lambda list descriptor if it's valid
+  object *list = codeparams(lambdacode(function));
+  if (list != NULL) {
+    int counts = first(list)->integer, required = counts & 0xFF, optional = counts>>8 & 0xFF, rest = counts>>16;
+    // Check the number of arguments against the descriptor, counting no further than it allows
+    int nargs = 0;
+    for (object *a = args; a != NULL && nargs <= required + optional; a = cdr(a)) nargs++;
+    if (nargs < required) {
+      if (name) error2(name, PSTR("has too few arguments"));
+      else error2(0, PSTR("function has too few arguments"));
+    }
+    if (nargs > required + optional && !rest) {
+      if (name) error2(name, PSTR("has too many arguments"));
+      else error2(0, PSTR("function has too many arguments"));
+    }
+    object *vars = second(list), *defaults = cddr(list);
+    for (int i=0; i<required + optional; i++) {
+      object *value;
+      if (args != NULL) { value = first(args); args = cdr(args); }
+      else if (first(defaults) == NULL) value = nil;
+      else {
+        push(list, GCStack); // In case evaluating the default replaces the descriptor
+        value = eval(first(defaults), *env);
+        pop(GCStack);
+      }
+      if (i >= required) defaults = cdr(defaults);
+      push(localbinding(first(vars), value), *env);
+      if (trace) { pserial(' '); printobject(value, pserial); }
+      vars = cdr(vars);
+    }
+    if (rest) {
+      push(localbinding(first(vars), args), *env);
+      if (trace) { pserial(' '); printobject(args, pserial); }
+      args = NULL;
+    }
+    params = NULL;
+  }
   boolean optional = false;
   while (params != NULL) {
     object *value;
@@ -1154,7 +2458,7 @@ object *closure (int tc, symbol_t name, object *state, object *function, object
           }
         } else { value = first(args); args = cdr(args); }
       }
-      push(cons(var,value), *env);
+      push(localbinding(var, value), *env);
       if (trace) { pserial(' '); printobject(value, pserial); }
     }
     params = cdr(params);  
@@ -1164,24 +2468,33 @@ object *closure (int tc, symbol_t name, object *state, object *function, object
     else error2(0, PSTR("function has too many arguments"));
   }
   if (trace) { pserial(')'); pln(pserial); }
+}
+
+object *closure (int tc, symbol_t name, object *state, object *function, object *args, object **env) {
+  bind(tc, name, state, function, args, env);
   // Do an implicit progn
   if (tc) push(nil, *env);
-  return tf_progn(function, *env);
+  return tf_progn(codebody(lambdacode(function)), *env);
 }
 
 object *apply (symbol_t name, object *function, object *args, object *env) {
   if (symbolp(function)) {
     symbol_t fname = function->name;
     checkargs(fname, args);
-    return ((fn_ptr_type)lookupfn(fname))(args, env);
+    return callfn(fname, args, env);
   }
-  if (consp(function) && issymbol(car(function), LAMBDA)) {
-    function = cdr(function);
+  if (lambdap(function)) {
+    #if defined(compiler)
+    if (compiled(function) != NULL) return vmrun(0, function, NULL, args, env);
+    #endif
     object *result = closure(0, 0, NULL, function, args, &env);
     return eval(result, env);
   }
   if (consp(function) && issymbol(car(function), CLOSURE)) {
     function = cdr(function);
+    #if defined(compiler)
+    if (compiled(cdr(function)) != NULL) return vmrun(0, cdr(function), car(function), args, env);
+    #endif
     object *result = closure(0, 0, car(function), cdr(function), args, &env);
     return eval(result, env);
   }
@@ -1189,10 +2502,610 @@ object *apply (symbol_t name, object *function, object *args, object *env) {
   return NULL;
 }
 
+#if defined(compiler)
+// Bytecode compiler
+
+/*
+  A function is compiled on its first call, from the body produced by the lexical analysis.
+  The code works on a value stack, but env is the same alist the interpreter would build,
+  so any form the compiler doesn't handle is compiled as a call to eval. The constants an
+  instruction refers to are stored ahead of the code, in a block that is freed when the
+  bytecode object holding it is collected.
+*/
+
+enum opcode { OP_NIL, OP_CONST, OP_LOCAL, OP_GLOBAL, OP_SETLOCAL, OP_SETGLOBAL, OP_CALLSITE, OP_TYPED, OP_POP, OP_JUMP, OP_JUMPNIL,
+OP_ANDJUMP, OP_ORJUMP, OP_PROGNJUMP, OP_LOOPJUMP, OP_RETURN, OP_BIND, OP_UNBIND, OP_SLIDE, OP_DOLIST,
+OP_DOTIMES, OP_DOTIMESTEP, OP_DOTIMESNEXT, OP_CLOSURE, OP_EVAL, OP_POLL, OP_CALL, OP_TAILCALL, OP_EXIT };
+
+#define MAXCONSTS 255 /* Index 255 is left for a call without a name */
+#define NONAME 255
+
+uint8_t *CompileCode = NULL;
+unsigned int CompileTop = 0, CompileSize = 0;
+object **CompileConsts = NULL;
+unsigned int CompileCount = 0;
+int CompileDepth = 0, CompileMax = 0;
+boolean CompileFailed = false;
+
+void emit (uint8_t byte) {
+  if (CompileFailed) return;
+  if (CompileTop == CompileSize) {
+    unsigned int size = (CompileSize == 0) ? 128 : CompileSize * 2;
+    uint8_t *code = (size > 65536) ? NULL : (uint8_t *)realloc(CompileCode, size);
+    if (code == NULL) { CompileFailed = true; return; }
+    CompileCode = code; CompileSize = size;
+  }
+  CompileCode[CompileTop++] = byte;
+}
+
+void emitop (uint8_t op, int effect) {
+  emit(op);
+  CompileDepth = CompileDepth + effect;
+  if (CompileDepth > CompileMax) CompileMax = CompileDepth;
+}
+
+uint8_t constant (object *obj) {
+  for (unsigned int i=0; i<CompileCount; i++) if (CompileConsts[i] == obj) return i;
+  if (CompileCount == MAXCONSTS) { CompileFailed = true; return 0; }
+  CompileConsts[CompileCount] = obj;
+  return CompileCount++;
+}
+
+// Until its label is placed, a forward jump holds the previous jump to the same label
+
+unsigned int emitjump (uint8_t op, int effect, unsigned int chain) {
+  emitop(op, effect);
+  unsigned int at = CompileTop;
+  emit(chain & 0xFF); emit(chain>>8);
+  return at;
+}
+
+void placelabel (unsigned int chain) {
+  while (chain != 0 && !CompileFailed) {
+    unsigned int next = CompileCode[chain] | CompileCode[chain+1]<<8;
+    CompileCode[chain] = CompileTop & 0xFF; CompileCode[chain+1] = CompileTop>>8;
+    chain = next;
+  }
+}
+
+void emitloop (unsigned int start) {
+  emitop(OP_POLL, 0);
+  emitop(OP_JUMP, 0);
+  emit(start & 0xFF); emit(start>>8);
+}
+
+void compileform (object *form, boolean tail);
+
+void compilebody (object *forms, boolean tail) {
+  if (forms == NULL) { emitop(OP_NIL, 1); return; }
+  unsigned int exits = 0;
+  while (consp(cdr(forms))) {
+    compileform(car(forms), false);
+    exits = emitjump(OP_PROGNJUMP, -1, exits);
+    forms = cdr(forms);
+  }
+  if (cdr(forms) != NULL) CompileFailed = true;
+  compileform(car(forms), tail);
+  placelabel(exits);
+}
+
+// Each form in a loop body stops the loop if it did a return
+
+void compileloopbody (object *forms, unsigned int *exits) {
+  while (consp(forms)) {
+    compileform(car(forms), false);
+    *exits = emitjump(OP_LOOPJUMP, -1, *exits);
+    forms = cdr(forms);
+  }
+}
+
+void compileeval (object *form) {
+  emitop(OP_EVAL, 1);
+  emit(constant(form));
+}
+
+boolean compilelet (symbol_t name, object *args, boolean tail) {
+  if (!consp(args) || !listp(first(args))) return false;
+  int n = 0;
+  object *assigns = first(args);
+  while (consp(assigns)) {
+    object *assign = car(assigns), *var = assign, *init = NULL;
+    if (consp(assign)) {
+      var = first(assign);
+      if (consp(cdr(assign))) init = second(assign);
+    }
+    if (!symbolp(var)) CompileFailed = true;
+    compileform(init, false);
+    if (name == LETSTAR) { emitop(OP_BIND, -1); emit(1); emit(constant(var)); }
+    n++;
+    assigns = cdr(assigns);
+  }
+  if (n > 255) CompileFailed = true;
+  if (name == LET && n > 0) {
+    emitop(OP_BIND, -n); emit(n);
+    for (assigns = first(args); consp(assigns); assigns = cdr(assigns)) {
+      object *assign = car(assigns);
+      emit(constant(consp(assign) ? first(assign) : assign));
+    }
+  }
+  compilebody(cdr(args), tail);
+  if (n > 0) { emitop(OP_UNBIND, 0); emit(n); }
+  return true;
+}
+
+boolean compilesetq (object *args) {
+  for (object *list = args; list != NULL; list = cddr(list)) {
+    if (!consp(list) || !consp(cdr(list))) return false;
+    object *var = first(list);
+    if (!localp(var) && !(symbolp(var) && var->name != NIL)) return false;
+  }
+  if (args == NULL) emitop(OP_NIL, 1);
+  while (args != NULL) {
+    object *var = first(args);
+    compileform(second(args), false);
+    emitop(localp(var) ? OP_SETLOCAL : OP_SETGLOBAL, 0);
+    emit(constant(var));
+    args = cddr(args);
+    if (args != NULL) emitop(OP_POP, -1);
+  }
+  return true;
+}
+
+boolean compilecond (object *clauses, boolean tail) {
+  for (object *list = clauses; list != NULL; list = cdr(list)) {
+    if (!consp(list) || !consp(car(list))) return false;
+  }
+  unsigned int exits = 0;
+  while (clauses != NULL) {
+    object *clause = first(clauses);
+    compileform(first(clause), false);
+    if (cdr(clause) == NULL) exits = emitjump(OP_ORJUMP, -1, exits);
+    else {
+      unsigned int next = emitjump(OP_JUMPNIL, -1, 0);
+      compilebody(cdr(clause), tail);
+      exits = emitjump(OP_JUMP, 0, exits);
+      CompileDepth--;
+      placelabel(next);
+    }
+    clauses = cdr(clauses);
+  }
+  emitop(OP_NIL, 1);
+  placelabel(exits);
+  return true;
+}
+
+void compilejunction (uint8_t op, object *args, boolean tail) {
+  unsigned int exits = 0;
+  while (consp(cdr(args))) {
+    compileform(car(args), false);
+    exits = emitjump(op, -1, exits);
+    args = cdr(args);
+  }
+  compileform(car(args), tail);
+  placelabel(exits);
+}
+
+boolean compileloop (symbol_t name, object *args) {
+  unsigned int start, exits = 0;
+  if (name == LOOP) {
+    start = CompileTop;
+    compileloopbody(args, &exits);
+    emitloop(start);
+    CompileDepth++;
+    placelabel(exits);
+    return true;
+  }
+  if (!consp(args) || !consp(first(args)) || !consp(cdr(first(args)))) return false;
+  object *params = first(args);
+  object *var = first(params);
+  if (!symbolp(var)) return false;
+  compileform(second(params), false);
+  unsigned int done;
+  if (name == DOLIST) {
+    emitop(OP_NIL, 1); // Index when it's a vector
+    emitop(OP_NIL, 1);
+    emitop(OP_BIND, -1); emit(1); emit(constant(var));
+    start = CompileTop;
+    done = emitjump(OP_DOLIST, 0, 0);
+    compileloopbody(cdr(args), &exits);
+  } else {
+    emitop(OP_DOTIMES, 1); emit(constant(var));
+    start = CompileTop;
+    done = emitjump(OP_DOTIMESTEP, 0, 0);
+    compileloopbody(cdr(args), &exits);
+    emitop(OP_DOTIMESNEXT, 0);
+  }
+  emitloop(start);
+  placelabel(done);
+  params = cddr(params);
+  compileform(consp(params) ? first(params) : NULL, false);
+  placelabel(exits);
+  emitop(OP_SLIDE, -2); emit(2);
+  emitop(OP_UNBIND, 0); emit(1);
+  return true;
+}
+
+void compilecall (object *form, boolean tail) {
+  object *function = car(form);
+  if (callsitep(function) && second(function)->name >= ENDFUNCTIONS && globalvalue(second(function)->name) == NULL) {
+    // Not defined yet, so leave it to eval in case it's a macro
+    compileeval(form);
+    return;
+  }
+  if (symbolp(function)) { emitop(OP_GLOBAL, 1); emit(constant(function)); }
+  else if (callsitep(function)) { emitop(OP_CALLSITE, 1); emit(constant(function)); function = second(function); }
+  else compileform(function, false);
+  int nargs = 0;
+  for (object *args = cdr(form); args != NULL; args = cdr(args)) {
+    compileform(car(args), false);
+    nargs++;
+  }
+  if (nargs > 255) CompileFailed = true;
+  emitop(tail ? OP_TAILCALL : OP_CALL, -nargs);
+  emit(nargs);
+  emit(symbolp(function) ? constant(function) : NONAME);
+}
+
+void compileform (object *form, boolean tail) {
+  if (form == NULL || issymbol(form, NIL)) { emitop(OP_NIL, 1); return; }
+  if (symbolp(form)) { emitop(OP_GLOBAL, 1); emit(constant(form)); return; }
+  if (!consp(form)) { emitop(OP_CONST, 1); emit(constant(form)); return; }
+  object *function = car(form);
+  object *args = cdr(form);
+  if (function != NULL && function->type == LOCAL) { emitop(OP_LOCAL, 1); emit(constant(form)); return; }
+  if (function != NULL && function->type == CALLSITE) { emitop(OP_CALLSITE, 1); emit(constant(form)); return; }
+  if (function != NULL && function->type == TYPED) {
+    compileform(first(cddr(form)), false);
+    compileform(second(cddr(form)), false);
+    emitop(OP_TYPED, -1); emit(function->integer); emit(second(form)->name);
+    return;
+  }
+  if (function == NULL || !listp(args)) { compileeval(form); return; }
+  if (codep(function)) { emitop(OP_CLOSURE, 1); emit(constant(form)); return; }
+
+  if (symbolp(function)) {
+    symbol_t name = function->name;
+    if (name == QUOTE && consp(args) && cdr(args) == NULL) {
+      emitop(OP_CONST, 1); emit(constant(first(args)));
+      return;
+    }
+    if (name == PROGN) { compilebody(args, tail); return; }
+    if ((name == IF && consp(args) && consp(cdr(args))) || ((name == WHEN || name == UNLESS) && consp(args))) {
+      compileform(first(args), false);
+      unsigned int other = emitjump(OP_JUMPNIL, -1, 0);
+      if (name == IF) compileform(second(args), tail);
+      else if (name == WHEN) compilebody(cdr(args), tail);
+      else emitop(OP_NIL, 1);
+      unsigned int done = emitjump(OP_JUMP, 0, 0);
+      CompileDepth--;
+      placelabel(other);
+      if (name == IF) compileform(consp(cddr(args)) ? third(args) : NULL, tail);
+      else if (name == WHEN) emitop(OP_NIL, 1);
+      else compilebody(cdr(args), tail);
+      placelabel(done);
+      return;
+    }
+    if (name == AND || name == OR) {
+      if (args == NULL) {
+        if (name == AND) { emitop(OP_CONST, 1); emit(constant(tee)); }
+        else emitop(OP_NIL, 1);
+      } else compilejunction((name == AND) ? OP_ANDJUMP : OP_ORJUMP, args, tail);
+      return;
+    }
+    if (name == COND && compilecond(args, tail)) return;
+    if ((name == LET || name == LETSTAR) && compilelet(name, args, tail)) return;
+    if (name == SETQ && compilesetq(args)) return;
+    if ((name == LOOP || name == DOLIST || name == DOTIMES) && compileloop(name, args)) return;
+    if (name == RETURN) {
+      compilebody(args, false);
+      emitop(OP_RETURN, 0);
+      return;
+    }
+    if (name < FUNCTIONS) { compileeval(form); return; }
+  }
+  compilecall(form, tail);
+}
+
+// Returns a bytecode object, or tee if the function can't be compiled
+
+object *compile (object *code) {
+  if (CompileConsts == NULL) {
+    CompileConsts = (object **)malloc(MAXCONSTS * sizeof(object *));
+    if (CompileConsts == NULL) return tee;
+  }
+  CompileTop = 0; CompileCount = 0;
+  CompileDepth = 0; CompileMax = 0;
+  CompileFailed = false;
+  compilebody(codebody(code), true);
+  emitop(OP_EXIT, -1);
+  if (CompileFailed || CompileMax > 250) return tee;
+  object *ptr = myalloc();
+  ptr->type = BYTECODE;
+  cdr(ptr) = NULL;
+  bytecode_t *bc = (bytecode_t *)malloc(sizeof(bytecode_t) + CompileCount * sizeof(object *) + CompileTop);
+  if (bc == NULL) return tee;
+  bc->length = CompileTop;
+  bc->nconsts = CompileCount;
+  bc->maxstack = CompileMax;
+  object **consts = (object **)(bc + 1);
+  memcpy(consts, CompileConsts, CompileCount * sizeof(object *));
+  memcpy(consts + CompileCount, CompileCode, CompileTop);
+  cdr(ptr) = (object *)bc;
+  return ptr;
+}
+
+// Returns the bytecode for a function, compiling it if this is its first call
+
+bytecode_t *compiled (object *function) {
+  object *code = lambdacode(function);
+  object *info = cdr(cddr(cddr(cdr(code))));
+  object *bytes = car(info);
+  if (bytes == NULL || (bytes != tee && cdr(bytes) == NULL)) {
+    bytes = compile(code);
+    car(info) = bytes;
+  }
+  return (bytes == tee) ? NULL : (bytecode_t *)cdr(bytes);
+}
+
+// Bytecode interpreter
+
+object *vmcall (symbol_t name, object *function, object *args, object *env) {
+  object *state = NULL;
+  if (consp(function) && issymbol(car(function), CLOSURE)) {
+    state = second(function);
+    function = cddr(function);
+  }
+  if (!lambdap(function)) error(0, PSTR("illegal function"), name ? symbol(name) : function);
+  if (compiled(function) != NULL) return vmrun(name, function, state, args, env);
+  int trace = name ? tracing(name) : 0;
+  object *form = closure(0, name, state, function, args, &env);
+  object *result = eval(form, env);
+  if (trace) tracereturn(trace, name, result);
+  return result;
+}
+
+#define JUMPTARGET (code + (pc[0] | pc[1]<<8))
+
+// Calls between compiled functions continue in the same loop, saving the caller in Frames, and the
+// caller's environment and code on the stack, so deep recursion doesn't use the C stack
+
+#define SAVEDSLOTS 4
+
+object *vmrun (symbol_t name, object *function, object *state, object *args, object *env) {
+  unsigned int fp = StackTop, frames = FrameTop;
+  object *base = env, *top;
+  boolean tailcalled = false;
+  int trace;
+  bytecode_t *bc;
+  object **consts, **sp;
+  uint8_t *code, *pc;
+
+  CALL:
+  bc = compiled(function);
+  growstack(fp + bc->maxstack + SAVEDSLOTS + 3);
+  // The function and its arguments stay on the stack while the parameters are bound
+  Stack[fp] = function; Stack[fp+1] = args; StackTop = fp + 2;
+  trace = name ? tracing(name) : 0;
+  bind(0, name, state, function, args, &env);
+  top = env;
+  consts = (object **)(bc + 1);
+  code = (uint8_t *)(consts + bc->nconsts);
+  pc = code;
+  sp = &Stack[fp+1];
+
+  for (;;) {
+    switch (*pc++) {
+      case OP_NIL: *sp++ = nil; break;
+      case OP_CONST: *sp++ = consts[*pc++]; break;
+      case OP_LOCAL: *sp++ = cdr(local(consts[*pc++], env)); break;
+      case OP_GLOBAL: {
+        object *var = consts[*pc++];
+        object *pair = value(var->name, env);
+        if (pair == NULL) pair = globalvalue(var->name);
+        if (pair != NULL) *sp++ = cdr(pair);
+        else if (var->name <= ENDFUNCTIONS || keywordp(var)) *sp++ = var;
+        else error(0, PSTR("undefined"), var);
+        break;
+      }
+      case OP_CALLSITE: *sp++ = callsite(consts[*pc++], env); break;
+      case OP_TYPED: {
+        object *arg = *--sp;
+        sp[-1] = typedcall(pc[0], pc[1], sp[-1], arg);
+        pc = pc + 2;
+        break;
+      }
+      case OP_SETLOCAL: cdr(local(consts[*pc++], env)) = sp[-1]; break;
+      case OP_SETGLOBAL: cdr(findvalue(consts[*pc++], env)) = sp[-1]; break;
+      case OP_POP: sp--; break;
+      case OP_JUMP: pc = JUMPTARGET; break;
+      case OP_JUMPNIL: if (*--sp == nil) pc = JUMPTARGET; else pc = pc + 2; break;
+      case OP_ANDJUMP: if (sp[-1] == nil) pc = JUMPTARGET; else { sp--; pc = pc + 2; } break;
+      case OP_ORJUMP: if (sp[-1] != nil) pc = JUMPTARGET; else { sp--; pc = pc + 2; } break;
+      case OP_PROGNJUMP: if (tstflag(RETURNFLAG)) pc = JUMPTARGET; else { sp--; pc = pc + 2; } break;
+      case OP_LOOPJUMP:
+        if (tstflag(RETURNFLAG)) { clrflag(RETURNFLAG); pc = JUMPTARGET; }
+        else { sp--; pc = pc + 2; }
+        break;
+      case OP_RETURN: setflag(RETURNFLAG); break;
+      case OP_BIND: {
+        int n = *pc++;
+        sp = sp - n;
+        for (int i=0; i<n; i++) push(localbinding(consts[*pc++], sp[i]), env);
+        break;
+      }
+      case OP_UNBIND: {
+        int n = *pc++;
+        while (n-- > 0) pop(env);
+        break;
+      }
+      case OP_SLIDE: {
+        int n = *pc++;
+        sp[-1-n] = sp[-1];
+        sp = sp - n;
+        break;
+      }
+      case OP_DOLIST: {
+        object *list = sp[-2];
+        if (vectorp(list)) {
+          if (sp[-1] == NULL) sp[-1] = number(0);
+          object *index = sp[-1];
+          if (index->integer >= vectorlength(list)) { cdr(car(env)) = nil; pc = JUMPTARGET; break; }
+          cdr(car(env)) = vectorref(list, index->integer++);
+          pc = pc + 2;
+          break;
+        }
+        if (list == NULL) { cdr(car(env)) = nil; pc = JUMPTARGET; break; }
+        if (improperp(list)) error(DOLIST, notproper, list);
+        cdr(car(env)) = first(list);
+        sp[-2] = cdr(list);
+        pc = pc + 2;
+        break;
+      }
+      case OP_DOTIMES: {
+        object *var = consts[*pc++];
+        checkinteger(DOTIMES, sp[-1]);
+        object *index = number(0);
+        *sp++ = index;
+        push(localbinding(var, index), env);
+        break;
+      }
+      case OP_DOTIMESTEP: {
+        object *index = sp[-1];
+        cdr(car(env)) = index;
+        if (index->integer >= sp[-2]->integer) pc = JUMPTARGET; else pc = pc + 2;
+        break;
+      }
+      case OP_DOTIMESNEXT: sp[-1] = number(sp[-1]->integer + 1); break;
+      case OP_CLOSURE: *sp++ = makeclosure(consts[*pc++], env); break;
+      case OP_EVAL: {
+        StackTop = sp - Stack;
+        object *result = eval(consts[*pc++], env);
+        sp = &Stack[StackTop]; // The stack may have moved
+        *sp++ = result;
+        break;
+      }
+      case OP_POLL:
+        StackTop = sp - Stack;
+        safepoint(NULL, env);
+        break;
+      case OP_CALL: case OP_TAILCALL: {
+        uint8_t op = pc[-1];
+        int nargs = *pc++, k = *pc++;
+        symbol_t fname = (k == NONAME) ? 0 : consts[k]->name;
+        StackTop = sp - Stack;
+        safepoint(NULL, env);
+        object **frame = sp - nargs - 1;
+        object *fn = frame[0], *list = NULL, *result;
+        fn_fixed_type fixed = fixedfn(fn, nargs);
+        if (fixed != NULL) {
+          // The arguments are already in an array on the stack, which a native function can move
+          unsigned int callee = frame - Stack;
+          result = fixed(frame + 1, env);
+          sp = &Stack[callee];
+          *sp++ = result;
+          break;
+        }
+        while (sp > frame + 1) list = cons(*--sp, list);
+        // Keep the argument list on the stack for the duration of the call
+        frame[1] = list;
+        sp = frame + 2;
+        StackTop = sp - Stack;
+        unsigned int callee = frame - Stack;
+        if (symbolp(fn) && (fn->name == FUNCALL || (fn->name == APPLY && nargs >= 2)) && nargs >= 1) {
+          // A funcall or apply of a compiled function continues in this loop too
+          object *target = first(list), *g = target;
+          if (consp(g) && issymbol(car(g), CLOSURE)) g = cddr(g);
+          if (lambdap(g) && compiled(g) != NULL) {
+            if (fn->name == FUNCALL) list = cdr(list);
+            else {
+              // Spread the last argument, as fn_apply does, in the list just made
+              object *previous = list, *last = cdr(list);
+              while (cdr(last) != NULL) { previous = last; last = cdr(last); }
+              object *arg = car(last);
+              if (!listp(arg)) error(APPLY, PSTR("last argument is not a list"), arg);
+              cdr(previous) = arg;
+              list = cdr(list);
+            }
+            fn = target; fname = 0;
+          }
+        }
+        if (symbolp(fn)) {
+          symbol_t bname = fn->name;
+          if (bname >= ENDFUNCTIONS) error(0, PSTR("not valid here"), fname ? symbol(fname) : fn);
+          if (nargs<lookupmin(bname)) error2(bname, PSTR("has too few arguments"));
+          if (nargs>lookupmax(bname)) error2(bname, PSTR("has too many arguments"));
+          result = callfn(bname, list, env);
+        } else {
+          object *fstate = NULL, *f = fn;
+          if (consp(fn) && issymbol(car(fn), CLOSURE)) { fstate = second(fn); f = cddr(fn); }
+          if (lambdap(f) && compiled(f) != NULL) {
+            if (op == OP_TAILCALL && !trace && !(fname && tracing(fname))) {
+              // Reuse this frame, dropping the bindings of a previous tail call as the interpreter does
+              if (tailcalled && env == top) env = base; else base = env;
+              tailcalled = true;
+              name = fname; function = f; state = fstate; args = list;
+              goto CALL;
+            }
+            if (FrameTop == FrameSize) growframes();
+            frame_t *saved = &Frames[FrameTop++];
+            saved->bc = bc; saved->pc = pc; saved->fp = fp;
+            saved->name = name; saved->trace = trace; saved->tailcalled = tailcalled;
+            // The caller's code keeps its bytecode, in case the function is compiled again
+            growstack(callee + SAVEDSLOTS);
+            Stack[callee] = env; Stack[callee+1] = base; Stack[callee+2] = top; Stack[callee+3] = car(function);
+            fp = callee + SAVEDSLOTS;
+            base = env; tailcalled = false;
+            name = fname; function = f; state = fstate; args = list;
+            goto CALL;
+          }
+          result = vmcall(fname, fn, list, env);
+        }
+        sp = &Stack[callee];
+        *sp++ = result;
+        break;
+      }
+      case OP_EXIT: {
+        object *result = sp[-1];
+        if (trace) tracereturn(trace, name, result);
+        if (FrameTop == frames) {
+          StackTop = fp;
+          return result;
+        }
+        // Continue the caller
+        frame_t *saved = &Frames[--FrameTop];
+        unsigned int callee = fp - SAVEDSLOTS;
+        env = Stack[callee]; base = Stack[callee+1]; top = Stack[callee+2];
+        bc = saved->bc; pc = saved->pc; fp = saved->fp;
+        name = saved->name; trace = saved->trace; tailcalled = saved->tailcalled;
+        function = Stack[fp];
+        consts = (object **)(bc + 1);
+        code = (uint8_t *)(consts + bc->nconsts);
+        sp = &Stack[callee];
+        *sp++ = result;
+        break;
+      }
+    }
+  }
+}
+#endif
+
 // In-place operations
 
+int vectorindex (symbol_t name, object *vector, object *arg) {
+  if (!vectorp(vector)) error(name, notavector, vector);
+  int index = checkinteger(name, arg);
+  if (index < 0 || index >= vectorlength(vector)) error(name, PSTR("index out of range"), arg);
+  return index;
+}
+
+// A byte in a byte vector has no object to point to, so it's updated through PlaceByte
+
+void storeplace (symbol_t name, object **loc) {
+  if (loc == &PlaceByte) vectorbytes(PlaceVector)[PlaceIndex] = checkbyte(name, PlaceByte);
+}
+
 object **place (symbol_t name, object *args, object *env) {
-  if (atom(args)) return &cdr(findvalue(args, env));
+  if (atom(args) || localp(args)) return &cdr(findvalue(args, env));
   object* function = first(args);
   if (issymbol(function, CAR) || issymbol(function, FIRST)) {
     object *value = eval(second(args), env);
@@ -1215,6 +3128,15 @@ object **place (symbol_t name, object *args, object *env) {
     }
     return &car(list);
   }
+  if (issymbol(function, AREF)) {
+    object *vector = eval(second(args), env);
+    PlaceVector = vector;
+    int index = vectorindex(name, vector, eval(third(args), env));
+    if (!bytevectorp(vector)) return &vectorelements(vector)[index];
+    PlaceIndex = index;
+    PlaceByte = number(vectorbytes(vector)[index]);
+    return &PlaceByte;
+  }
   error2(name, PSTR("illegal place"));
   return nil;
 }
@@ -1324,7 +3246,7 @@ gfun_t gstreamfun (object *args) {
   int streamtype = SERIALSTREAM;
   int address = 0;
   gfun_t gfun = gserial;
-  if (args != NULL) {
+  if (args != NULL && first(args) != NULL) {
     int stream = isstream(first(args));
     streamtype = stream>>8; address = stream & 0xFF;
   }
@@ -1372,6 +3294,54 @@ pfun_t pstreamfun (object *args) {
   return pfun;
 }
 
+// Files, the WiFi client, and SPI move a whole buffer in one transfer; other streams go a byte at a time
+
+int readbytes (object *args, uint8_t *buffer, int length) {
+  int streamtype = (args != NULL && first(args) != NULL) ? isstream(first(args))>>8 : SERIALSTREAM;
+  if (streamtype == SPISTREAM) {
+    memset(buffer, 0, length);
+    SPI.transfer(buffer, length);
+    return length;
+  }
+  int n = 0;
+  #if defined(sdcardsupport)
+  if (streamtype == SDSTREAM || streamtype == SPIFFSSTREAM || streamtype == WIFISTREAM) {
+  #else
+  if (streamtype == SPIFFSSTREAM || streamtype == WIFISTREAM) {
+  #endif
+    if (LastChar && length > 0) { buffer[n++] = LastChar; LastChar = 0; }
+    int got;
+    if (streamtype == WIFISTREAM) got = client.read(buffer + n, length - n);
+    #if defined(sdcardsupport)
+    else if (streamtype == SDSTREAM) got = SDgfile.read(buffer + n, length - n);
+    #endif
+    else got = SPIFFSgfile.read(buffer + n, length - n);
+    return (got > 0) ? n + got : n;
+  }
+  gfun_t gfun = gstreamfun(args);
+  while (n < length) {
+    int c = gfun();
+    if (c == -1) break;
+    buffer[n++] = c;
+  }
+  return n;
+}
+
+void writebytes (object *args, const uint8_t *buffer, int length) {
+  int streamtype = (args != NULL && first(args) != NULL) ? isstream(first(args))>>8 : SERIALSTREAM;
+  if (streamtype == SPISTREAM) SPI.writeBytes(buffer, length);
+  else if (streamtype == I2CSTREAM) Wire.write(buffer, length);
+  #if defined(sdcardsupport)
+  else if (streamtype == SDSTREAM) SDpfile.write(buffer, length);
+  #endif
+  else if (streamtype == SPIFFSSTREAM) SPIFFSpfile.write(buffer, length);
+  else if (streamtype == WIFISTREAM) client.write(buffer, length);
+  else {
+    pfun_t pfun = pstreamfun(args);
+    for (int i=0; i<length; i++) pfun(buffer[i]);
+  }
+}
+
 // Check pins
 
 void checkanalogread (int pin) {
@@ -1435,9 +3405,17 @@ object *sp_defun (object *args, object *env) {
   object *var = first(args);
   if (var->type != SYMBOL) error(DEFUN, PSTR("not a symbol"), var);
   object *val = cons(symbol(LAMBDA), cdr(args));
-  object *pair = value(var->name,GlobalEnv);
-  if (pair != NULL) { cdr(pair) = val; return var; }
-  push(cons(var, val), GlobalEnv);
+  defglobal(var, val);
+  return var;
+}
+
+object *sp_defmacro (object *args, object *env) {
+  (void) env;
+  checkargs(DEFMACRO, args);
+  object *var = first(args);
+  if (var->type != SYMBOL) error(DEFMACRO, PSTR("not a symbol"), var);
+  object *val = cons(symbol(MACRO), cons(symbol(LAMBDA), cdr(args)));
+  defglobal(var, val);
   return var;
 }
 
@@ -1447,9 +3425,7 @@ object *sp_defvar (object *args, object *env) {
   if (var->type != SYMBOL) error(DEFVAR, PSTR("not a symbol"), var);
   object *val = NULL;
   val = eval(second(args), env);
-  object *pair = value(var->name, GlobalEnv);
-  if (pair != NULL) { cdr(pair) = val; return var; }
-  push(cons(var, val), GlobalEnv);
+  defglobal(var, val);
   return var;
 }
 
@@ -1492,12 +3468,14 @@ object *sp_push (object *args, object *env) {
   object *item = eval(first(args), env);
   object **loc = place(PUSH, second(args), env);
   push(item, *loc);
+  storeplace(PUSH, loc);
   return *loc;
 }
 
 object *sp_pop (object *args, object *env) {
   checkargs(POP, args); 
   object **loc = place(POP, first(args), env);
+  if (!listp(*loc)) error(POP, notalist, *loc);
   object *result = car(*loc);
   pop(*loc);
   return result;
@@ -1536,6 +3514,7 @@ object *sp_incf (object *args, object *env) {
       else *loc = number(value + increment);
     }
   } else error2(INCF, notanumber);
+  storeplace(INCF, loc);
   return *loc;
 }
 
@@ -1570,6 +3549,7 @@ object *sp_decf (object *args, object *env) {
       else *loc = number(value - decrement);
     }
   } else error2(DECF, notanumber);
+  storeplace(DECF, loc);
   return *loc;
 }
 
@@ -1580,24 +3560,40 @@ object *sp_setf (object *args, object *env) {
     object **loc = place(SETF, first(args), env);
     arg = eval(second(args), env);
     *loc = arg;
+    storeplace(SETF, loc);
     args = cddr(args);
   }
   return arg;
 }
 
+// Steps dolist through a list, or a vector by index, and returns false at the end
+
+boolean dolistitem (object **list, int *index, object **item) {
+  object *arg = *list;
+  if (arg == NULL) return false;
+  if (vectorp(arg)) {
+    if (*index >= vectorlength(arg)) return false;
+    *item = vectorref(arg, (*index)++);
+    return true;
+  }
+  if (improperp(arg)) error(DOLIST, notproper, arg);
+  *item = first(arg);
+  *list = cdr(arg);
+  return true;
+}
+
 object *sp_dolist (object *args, object *env) {
   if (args == NULL) error2(DOLIST, noargument);
   object *params = first(args);
   object *var = first(params);
   object *list = eval(second(params), env);
   push(list, GCStack); // Don't GC the list
-  object *pair = cons(var,nil);
+  object *pair = localbinding(var, nil);
   push(pair,env);
   params = cdr(cdr(params));
   args = cdr(args);
-  while (list != NULL) {
-    if (improperp(list)) error(DOLIST, notproper, list);
-    cdr(pair) = first(list);
+  int index = 0;
+  while (dolistitem(&list, &index, &cdr(pair))) {
     object *forms = args;
     while (forms != NULL) {
       object *result = eval(car(forms), env);
@@ -1608,7 +3604,6 @@ object *sp_dolist (object *args, object *env) {
       }
       forms = cdr(forms);
     }
-    list = cdr(list);
   }
   cdr(pair) = nil;
   pop(GCStack);
@@ -1623,7 +3618,7 @@ object *sp_dotimes (object *args, object *env) {
   int count = checkinteger(DOTIMES, eval(second(params), env));
   int index = 0;
   params = cdr(cdr(params));
-  object *pair = cons(var,number(0));
+  object *pair = localbinding(var, number(0));
   push(pair,env);
   args = cdr(args);
   while (index < count) {
@@ -1698,7 +3693,7 @@ object *sp_withserial (object *args, object *env) {
   params = cddr(params);
   int baud = 96;
   if (params != NULL) baud = checkinteger(WITHSERIAL, eval(first(params), env));
-  object *pair = cons(var, stream(SERIALSTREAM, address));
+  object *pair = localbinding(var, stream(SERIALSTREAM, address));
   push(pair,env);
   serialbegin(address, baud);
   object *forms = cdr(args);
@@ -1721,7 +3716,7 @@ object *sp_withi2c (object *args, object *env) {
     read = (rw != NULL);
   }
   I2Cinit(1); // Pullups
-  object *pair = cons(var, (I2Cstart(address, read)) ? stream(I2CSTREAM, address) : nil);
+  object *pair = localbinding(var, (I2Cstart(address, read)) ? stream(I2CSTREAM, address) : nil);
   push(pair,env);
   object *forms = cdr(args);
   object *result = eval(tf_progn(forms,env), env);
@@ -1753,7 +3748,7 @@ object *sp_withspi (object *args, object *env) {
       }
     }
   }
-  object *pair = cons(var, stream(SPISTREAM, pin));
+  object *pair = localbinding(var, stream(SPISTREAM, pin));
   push(pair,env);
   SPI.begin();
   SPI.beginTransaction(SPISettings(((unsigned long)clock * 1000), bitorder, mode));
@@ -1783,7 +3778,7 @@ object *sp_withsdcard (object *args, object *env) {
     SDgfile = SD.open(MakeFilename(filename), oflag);
     if (!SDgfile) error2(WITHSDCARD, PSTR("problem reading from SD card"));
   }
-  object *pair = cons(var, stream(SDSTREAM, 1));
+  object *pair = localbinding(var, stream(SDSTREAM, 1));
   push(pair,env);
   object *forms = cdr(args);
   object *result = eval(tf_progn(forms,env), env);
@@ -1813,7 +3808,7 @@ object *sp_withspiffs (object *args, object *env) {
     SPIFFSgfile = SPIFFS.open(MakeFilename(filename), oflag);
     if (!SPIFFSgfile) error2(WITHSPIFFS, PSTR("problem reading from SPIFFS"));
   }
-  object *pair = cons(var, stream(SPIFFSSTREAM, 1));
+  object *pair = localbinding(var, stream(SPIFFSSTREAM, 1));
   push(pair,env);
   object *forms = cdr(args);
   object *result = eval(tf_progn(forms,env), env);
@@ -1840,7 +3835,7 @@ object *sp_withclient (object *args, object *env) {
     if (!success) return nil;
     n = 1;
   }
-  object *pair = cons(var, stream(WIFISTREAM, n));
+  object *pair = localbinding(var, stream(WIFISTREAM, n));
   push(pair,env);
   object *forms = cdr(args);
   object *result = eval(tf_progn(forms,env), env);
@@ -1848,6 +3843,13 @@ object *sp_withclient (object *args, object *env) {
   return result;
 }
 
+// Declarations are used when a function is analysed, so are ignored here
+
+object *sp_declare (object *args, object *env) {
+  (void) args, (void) env;
+  return nil;
+}
+
 // Tail-recursive forms
 
 object *tf_progn (object *args, object *env) {
@@ -1935,125 +3937,126 @@ object *tf_or (object *args, object *env) {
 
 // Core functions
 
-object *fn_not (object *args, object *env) {
+object *fn_not (object **args, object *env) {
   (void) env;
-  return (first(args) == nil) ? tee : nil;
+  return (args[0] == nil) ? tee : nil;
 }
 
-object *fn_cons (object *args, object *env) {
+object *fn_cons (object **args, object *env) {
   (void) env;
-  return cons(first(args), second(args));
+  return cons(args[0], args[1]);
 }
 
-object *fn_atom (object *args, object *env) {
+object *fn_atom (object **args, object *env) {
   (void) env;
-  return atom(first(args)) ? tee : nil;
+  return atom(args[0]) ? tee : nil;
 }
 
-object *fn_listp (object *args, object *env) {
+object *fn_listp (object **args, object *env) {
   (void) env;
-  return listp(first(args)) ? tee : nil;
+  return listp(args[0]) ? tee : nil;
 }
 
-object *fn_consp (object *args, object *env) {
+object *fn_consp (object **args, object *env) {
   (void) env;
-  return consp(first(args)) ? tee : nil;
+  return consp(args[0]) ? tee : nil;
 }
 
-object *fn_symbolp (object *args, object *env) {
+object *fn_symbolp (object **args, object *env) {
   (void) env;
-  object *arg = first(args);
+  object *arg = args[0];
   return symbolp(arg) ? tee : nil;
 }
 
-object *fn_streamp (object *args, object *env) {
+object *fn_streamp (object **args, object *env) {
   (void) env;
-  object *arg = first(args);
+  object *arg = args[0];
   return streamp(arg) ? tee : nil;
 }
 
-object *fn_eq (object *args, object *env) {
+object *fn_eq (object **args, object *env) {
   (void) env;
-  return eq(first(args), second(args)) ? tee : nil;
+  return eq(args[0], args[1]) ? tee : nil;
 }
 
 // List functions
 
-object *fn_car (object *args, object *env) {
+object *fn_car (object **args, object *env) {
   (void) env;
-  return carx(first(args));
+  return carx(args[0]);
 }
 
-object *fn_cdr (object *args, object *env) {
+object *fn_cdr (object **args, object *env) {
   (void) env;
-  return cdrx(first(args));
+  return cdrx(args[0]);
 }
 
-object *fn_caar (object *args, object *env) {
+object *fn_caar (object **args, object *env) {
   (void) env;
-  return carx(carx(first(args)));
+  return carx(carx(args[0]));
 }
 
-object *fn_cadr (object *args, object *env) {
+object *fn_cadr (object **args, object *env) {
   (void) env;
-  return carx(cdrx(first(args)));
+  return carx(cdrx(args[0]));
 }
 
-object *fn_cdar (object *args, object *env) {
+object *fn_cdar (object **args, object *env) {
   (void) env;
-  return cdrx(carx(first(args)));
+  return cdrx(carx(args[0]));
 }
 
-object *fn_cddr (object *args, object *env) {
+object *fn_cddr (object **args, object *env) {
   (void) env;
-  return cdrx(cdrx(first(args)));
+  return cdrx(cdrx(args[0]));
 }
 
-object *fn_caaar (object *args, object *env) {
+object *fn_caaar (object **args, object *env) {
   (void) env;
-  return carx(carx(carx(first(args))));
+  return carx(carx(carx(args[0])));
 }
 
-object *fn_caadr (object *args, object *env) {
+object *fn_caadr (object **args, object *env) {
   (void) env;
-  return carx(carx(cdrx(first(args))));
+  return carx(carx(cdrx(args[0])));
 }
 
-object *fn_cadar (object *args, object *env) {
+object *fn_cadar (object **args, object *env) {
   (void) env;
-  return carx(cdrx(carx(first(args))));
+  return carx(cdrx(carx(args[0])));
 }
 
-object *fn_caddr (object *args, object *env) {
+object *fn_caddr (object **args, object *env) {
   (void) env;
-  return carx(cdrx(cdrx(first(args))));
+  return carx(cdrx(cdrx(args[0])));
 }
 
-object *fn_cdaar (object *args, object *env) {
+object *fn_cdaar (object **args, object *env) {
   (void) env;
-  return cdrx(carx(carx(first(args))));
+  return cdrx(carx(carx(args[0])));
 }
 
-object *fn_cdadr (object *args, object *env) {
+object *fn_cdadr (object **args, object *env) {
   (void) env;
-  return cdrx(carx(cdrx(first(args))));
+  return cdrx(carx(cdrx(args[0])));
 }
 
-object *fn_cddar (object *args, object *env) {
+object *fn_cddar (object **args, object *env) {
   (void) env;
-  return cdrx(cdrx(carx(first(args))));
+  return cdrx(cdrx(carx(args[0])));
 }
 
-object *fn_cdddr (object *args, object *env) {
+object *fn_cdddr (object **args, object *env) {
   (void) env;
-  return cdrx(cdrx(cdrx(first(args))));
+  return cdrx(cdrx(cdrx(args[0])));
 }
 
-object *fn_length (object *args, object *env) {
+object *fn_length (object **args, object *env) {
   (void) env;
-  object *arg = first(args);
+  object *arg = args[0];
   if (listp(arg)) return number(listlength(LENGTH, arg));
-  if (!stringp(arg)) error(LENGTH, PSTR("argument is not a list or string"), arg);
+  if (vectorp(arg)) return number(vectorlength(arg));
+  if (!stringp(arg)) error(LENGTH, PSTR("argument is not a list, string, or vector"), arg);
   return number(stringlength(arg));
 }
 
@@ -2062,9 +4065,9 @@ object *fn_list (object *args, object *env) {
   return args;
 }
 
-object *fn_reverse (object *args, object *env) {
-  (void) env;
-  object *list = first(args);
+object *fn_reverse (object **args, object *env) {
+  object *list = args[0];
+  roomfor(list, 1, list, env);
   object *result = NULL;
   while (list != NULL) {
     if (improperp(list)) error(REVERSE, notproper, list);
@@ -2074,10 +4077,10 @@ object *fn_reverse (object *args, object *env) {
   return result;
 }
 
-object *fn_nth (object *args, object *env) {
+object *fn_nth (object **args, object *env) {
   (void) env;
-  int n = checkinteger(NTH, first(args));
-  object *list = second(args);
+  int n = checkinteger(NTH, args[0]);
+  object *list = args[1];
   while (list != NULL) {
     if (improperp(list)) error(NTH, notproper, list);
     if (n == 0) return car(list);
@@ -2087,17 +4090,17 @@ object *fn_nth (object *args, object *env) {
   return nil;
 }
 
-object *fn_assoc (object *args, object *env) {
+object *fn_assoc (object **args, object *env) {
   (void) env;
-  object *key = first(args);
-  object *list = second(args);
+  object *key = args[0];
+  object *list = args[1];
   return assoc(key,list);
 }
 
-object *fn_member (object *args, object *env) {
+object *fn_member (object **args, object *env) {
   (void) env;
-  object *item = first(args);
-  object *list = second(args);
+  object *item = args[0];
+  object *list = args[1];
   while (list != NULL) {
     if (improperp(list)) error(MEMBER, notproper, list);
     if (eq(item,car(list))) return list;
@@ -2124,7 +4127,7 @@ object *fn_funcall (object *args, object *env) {
 }
 
 object *fn_append (object *args, object *env) {
-  (void) env;
+  for (object *a = args; cdr(a) != NULL; a = cdr(a)) roomfor(first(a), 1, args, env);
   object *head = NULL;
   object *tail;
   while (args != NULL) {   
@@ -2170,6 +4173,8 @@ object *fn_mapc (object *args, object *env) {
 }
 
 object *fn_mapcar (object *args, object *env) {
+  // A cell for each result, and one for each list's parameter
+  roomfor(second(args), 1 + listlength(MAPCAR, cdr(args)), args, env);
   object *function = first(args);
   args = cdr(args);
   object *params = cons(NULL, NULL);
@@ -2236,6 +4241,33 @@ object *fn_mapcan (object *args, object *env) {
 
 // Arithmetic functions
 
+// Integer arithmetic giving true on overflow - GCC before version 5, as used for the ESP8266, lacks the builtins
+
+#if defined(__GNUC__) && __GNUC__ >= 5
+#define addoverflow(a, b, r)       __builtin_sadd_overflow((a), (b), (r))
+#define subtractoverflow(a, b, r)  __builtin_ssub_overflow((a), (b), (r))
+#define multiplyoverflow(a, b, r)  __builtin_smul_overflow((a), (b), (r))
+#else
+inline boolean addoverflow (int a, int b, int *r) {
+  if ((b < 1) ? (INT_MIN - b > a) : (INT_MAX - b < a)) return true;
+  *r = a + b;
+  return false;
+}
+
+inline boolean subtractoverflow (int a, int b, int *r) {
+  if ((b < 1) ? (INT_MAX + b < a) : (INT_MIN + b > a)) return true;
+  *r = a - b;
+  return false;
+}
+
+inline boolean multiplyoverflow (int a, int b, int *r) {
+  int64_t val = a * (int64_t)b;
+  if ((val > INT_MAX) || (val < INT_MIN)) return true;
+  *r = val;
+  return false;
+}
+#endif
+
 object *add_floats (object *args, float fresult) {
   while (args != NULL) {
     object *arg = car(args);
@@ -2252,16 +4284,24 @@ object *fn_add (object *args, object *env) {
     object *arg = car(args);
     if (floatp(arg)) return add_floats(args, (float)result);
     else if (integerp(arg)) {
-      int val = arg->integer;
-      if (val < 1) { if (INT_MIN - val > result) return add_floats(args, (float)result); }
-      else { if (INT_MAX - val < result) return add_floats(args, (float)result); }
-      result = result + val;
+      int sum;
+      if (addoverflow(result, arg->integer, &sum)) return add_floats(args, (float)result);
+      result = sum;
     } else error(ADD, notanumber, arg);
     args = cdr(args);
   }
   return number(result);
 }
 
+object *fn_add2 (object **args, object *env) {
+  (void) env;
+  object *arg1 = args[0], *arg2 = args[1];
+  int result;
+  if (integerp(arg1) && integerp(arg2) && !addoverflow(arg1->integer, arg2->integer, &result)) return number(result);
+  float f1 = checkintfloat(ADD, arg1), f2 = checkintfloat(ADD, arg2);
+  return makefloat(f1 + f2);
+}
+
 object *subtract_floats (object *args, float fresult) {
   while (args != NULL) {
     object *arg = car(args);
@@ -2292,10 +4332,9 @@ object *fn_subtract (object *args, object *env) {
       arg = car(args);
       if (floatp(arg)) return subtract_floats(args, result);
       else if (integerp(arg)) {
-        int val = (car(args))->integer;
-        if (val < 1) { if (INT_MAX + val < result) return subtract_floats(args, result); }
-        else { if (INT_MIN + val > result) return subtract_floats(args, result); }
-        result = result - val;
+        int difference;
+        if (subtractoverflow(result, arg->integer, &difference)) return subtract_floats(args, result);
+        result = difference;
       } else error(SUBTRACT, notanumber, arg);
       args = cdr(args);
     }
@@ -2303,6 +4342,15 @@ object *fn_subtract (object *args, object *env) {
   } else error(SUBTRACT, notanumber, arg);
 }
 
+object *fn_subtract2 (object **args, object *env) {
+  (void) env;
+  object *arg1 = args[0], *arg2 = args[1];
+  int result;
+  if (integerp(arg1) && integerp(arg2) && !subtractoverflow(arg1->integer, arg2->integer, &result)) return number(result);
+  float f1 = checkintfloat(SUBTRACT, arg1), f2 = checkintfloat(SUBTRACT, arg2);
+  return makefloat(f1 - f2);
+}
+
 object *multiply_floats (object *args, float fresult) {
   while (args != NULL) {
    object *arg = car(args);
@@ -2319,15 +4367,24 @@ object *fn_multiply (object *args, object *env) {
     object *arg = car(args);
     if (floatp(arg)) return multiply_floats(args, result);
     else if (integerp(arg)) {
-      int64_t val = result * (int64_t)(arg->integer);
-      if ((val > INT_MAX) || (val < INT_MIN)) return multiply_floats(args, result);
-      result = val;
+      int product;
+      if (multiplyoverflow(result, arg->integer, &product)) return multiply_floats(args, result);
+      result = product;
     } else error(MULTIPLY, notanumber, arg);
     args = cdr(args);
   }
   return number(result);
 }
 
+object *fn_multiply2 (object **args, object *env) {
+  (void) env;
+  object *arg1 = args[0], *arg2 = args[1];
+  int result;
+  if (integerp(arg1) && integerp(arg2) && !multiplyoverflow(arg1->integer, arg2->integer, &result)) return number(result);
+  float f1 = checkintfloat(MULTIPLY, arg1), f2 = checkintfloat(MULTIPLY, arg2);
+  return makefloat(f1 * f2);
+}
+
 object *divide_floats (object *args, float fresult) {
   while (args != NULL) {
     object *arg = car(args);
@@ -2377,10 +4434,10 @@ object *fn_divide (object *args, object *env) {
   } else error(DIVIDE, notanumber, arg);
 }
 
-object *fn_mod (object *args, object *env) {
+object *fn_mod (object **args, object *env) {
   (void) env;
-  object *arg1 = first(args);
-  object *arg2 = second(args);
+  object *arg1 = args[0];
+  object *arg2 = args[1];
   if (integerp(arg1) && integerp(arg2)) {
     int divisor = arg2->integer;
     if (divisor == 0) error2(MOD, PSTR("division by zero"));
@@ -2398,9 +4455,9 @@ object *fn_mod (object *args, object *env) {
   }
 }
 
-object *fn_oneplus (object *args, object *env) {
+object *fn_oneplus (object **args, object *env) {
   (void) env;
-  object* arg = first(args);
+  object* arg = args[0];
   if (floatp(arg)) return makefloat((arg->single_float) + 1.0);
   else if (integerp(arg)) {
     int result = arg->integer;
@@ -2409,9 +4466,9 @@ object *fn_oneplus (object *args, object *env) {
   } else error(ONEPLUS, notanumber, arg);
 }
 
-object *fn_oneminus (object *args, object *env) {
+object *fn_oneminus (object **args, object *env) {
   (void) env;
-  object* arg = first(args);
+  object* arg = args[0];
   if (floatp(arg)) return makefloat((arg->single_float) - 1.0);
   else if (integerp(arg)) {
     int result = arg->integer;
@@ -2420,9 +4477,9 @@ object *fn_oneminus (object *args, object *env) {
   } else error(ONEMINUS, notanumber, arg);
 }
 
-object *fn_abs (object *args, object *env) {
+object *fn_abs (object **args, object *env) {
   (void) env;
-  object *arg = first(args);
+  object *arg = args[0];
   if (floatp(arg)) return makefloat(abs(arg->single_float));
   else if (integerp(arg)) {
     int result = arg->integer;
@@ -2487,6 +4544,14 @@ object *fn_noteq (object *args, object *env) {
   return tee;
 }
 
+object *fn_noteq2 (object **args, object *env) {
+  (void) env;
+  object *arg1 = args[0], *arg2 = args[1];
+  if (integerp(arg1) && integerp(arg2)) return ((arg1->integer) != (arg2->integer)) ? tee : nil;
+  float f1 = checkintfloat(NOTEQ, arg1), f2 = checkintfloat(NOTEQ, arg2);
+  return (f1 != f2) ? tee : nil;
+}
+
 object *fn_numeq (object *args, object *env) {
   (void) env;
   object *arg1 = first(args);
@@ -2502,6 +4567,14 @@ object *fn_numeq (object *args, object *env) {
   return tee;
 }
 
+object *fn_numeq2 (object **args, object *env) {
+  (void) env;
+  object *arg1 = args[0], *arg2 = args[1];
+  if (integerp(arg1) && integerp(arg2)) return ((arg1->integer) == (arg2->integer)) ? tee : nil;
+  float f1 = checkintfloat(NUMEQ, arg1), f2 = checkintfloat(NUMEQ, arg2);
+  return (f1 == f2) ? tee : nil;
+}
+
 object *fn_less (object *args, object *env) {
   (void) env;
   object *arg1 = first(args);
@@ -2517,6 +4590,14 @@ object *fn_less (object *args, object *env) {
   return tee;
 }
 
+object *fn_less2 (object **args, object *env) {
+  (void) env;
+  object *arg1 = args[0], *arg2 = args[1];
+  if (integerp(arg1) && integerp(arg2)) return ((arg1->integer) < (arg2->integer)) ? tee : nil;
+  float f1 = checkintfloat(LESS, arg1), f2 = checkintfloat(LESS, arg2);
+  return (f1 < f2) ? tee : nil;
+}
+
 object *fn_lesseq (object *args, object *env) {
   (void) env;
   object *arg1 = first(args);
@@ -2532,6 +4613,14 @@ object *fn_lesseq (object *args, object *env) {
   return tee;
 }
 
+object *fn_lesseq2 (object **args, object *env) {
+  (void) env;
+  object *arg1 = args[0], *arg2 = args[1];
+  if (integerp(arg1) && integerp(arg2)) return ((arg1->integer) <= (arg2->integer)) ? tee : nil;
+  float f1 = checkintfloat(LESSEQ, arg1), f2 = checkintfloat(LESSEQ, arg2);
+  return (f1 <= f2) ? tee : nil;
+}
+
 object *fn_greater (object *args, object *env) {
   (void) env;
   object *arg1 = first(args);
@@ -2547,6 +4636,14 @@ object *fn_greater (object *args, object *env) {
   return tee;
 }
 
+object *fn_greater2 (object **args, object *env) {
+  (void) env;
+  object *arg1 = args[0], *arg2 = args[1];
+  if (integerp(arg1) && integerp(arg2)) return ((arg1->integer) > (arg2->integer)) ? tee : nil;
+  float f1 = checkintfloat(GREATER, arg1), f2 = checkintfloat(GREATER, arg2);
+  return (f1 > f2) ? tee : nil;
+}
+
 object *fn_greatereq (object *args, object *env) {
   (void) env;
   object *arg1 = first(args);
@@ -2562,52 +4659,60 @@ object *fn_greatereq (object *args, object *env) {
   return tee;
 }
 
-object *fn_plusp (object *args, object *env) {
+object *fn_greatereq2 (object **args, object *env) {
   (void) env;
-  object *arg = first(args);
+  object *arg1 = args[0], *arg2 = args[1];
+  if (integerp(arg1) && integerp(arg2)) return ((arg1->integer) >= (arg2->integer)) ? tee : nil;
+  float f1 = checkintfloat(GREATEREQ, arg1), f2 = checkintfloat(GREATEREQ, arg2);
+  return (f1 >= f2) ? tee : nil;
+}
+
+object *fn_plusp (object **args, object *env) {
+  (void) env;
+  object *arg = args[0];
   if (floatp(arg)) return ((arg->single_float) > 0.0) ? tee : nil;
   else if (integerp(arg)) return ((arg->integer) > 0) ? tee : nil;
   else error(PLUSP, notanumber, arg);
 }
 
-object *fn_minusp (object *args, object *env) {
+object *fn_minusp (object **args, object *env) {
   (void) env;
-  object *arg = first(args);
+  object *arg = args[0];
   if (floatp(arg)) return ((arg->single_float) < 0.0) ? tee : nil;
   else if (integerp(arg)) return ((arg->integer) < 0) ? tee : nil;
   else error(MINUSP, notanumber, arg);
 }
 
-object *fn_zerop (object *args, object *env) {
+object *fn_zerop (object **args, object *env) {
   (void) env;
-  object *arg = first(args);
+  object *arg = args[0];
   if (floatp(arg)) return ((arg->single_float) == 0.0) ? tee : nil;
   else if (integerp(arg)) return ((arg->integer) == 0) ? tee : nil;
   else error(ZEROP, notanumber, arg);
 }
 
-object *fn_oddp (object *args, object *env) {
+object *fn_oddp (object **args, object *env) {
   (void) env;
-  int arg = checkinteger(ODDP, first(args));
+  int arg = checkinteger(ODDP, args[0]);
   return ((arg & 1) == 1) ? tee : nil;
 }
 
-object *fn_evenp (object *args, object *env) {
+object *fn_evenp (object **args, object *env) {
   (void) env;
-  int arg = checkinteger(EVENP, first(args));
+  int arg = checkinteger(EVENP, args[0]);
   return ((arg & 1) == 0) ? tee : nil;
 }
 
 // Number functions
 
-object *fn_integerp (object *args, object *env) {
+object *fn_integerp (object **args, object *env) {
   (void) env;
-  return integerp(first(args)) ? tee : nil;
+  return integerp(args[0]) ? tee : nil;
 }
 
-object *fn_numberp (object *args, object *env) {
+object *fn_numberp (object **args, object *env) {
   (void) env;
-  object *arg = first(args);
+  object *arg = args[0];
   return (integerp(arg) || floatp(arg)) ? tee : nil;
 }
 
@@ -2785,6 +4890,17 @@ object *fn_stringp (object *args, object *env) {
 bool stringcompare (symbol_t name, object *args, bool lt, bool gt, bool eq) {
   object *arg1 = first(args); if (!stringp(arg1)) error(name, notastring, arg1);
   object *arg2 = second(args); if (!stringp(arg2)) error(name, notastring, arg2); 
+  if (arg1->type == LONGSTRING || arg2->type == LONGSTRING) {
+    int length1 = stringlength(arg1), length2 = stringlength(arg2);
+    int length = (length1 < length2) ? length1 : length2, test = 0;
+    if (arg1->type == LONGSTRING && arg2->type == LONGSTRING) {
+      test = memcmp(stringchars(arg1), stringchars(arg2), length);
+    } else {
+      for (int i=0; i<length && test == 0; i++) test = (uint8_t)nthchar(arg1, i) - (uint8_t)nthchar(arg2, i);
+    }
+    if (test == 0) test = length1 - length2;
+    return (test < 0) ? lt : (test > 0) ? gt : eq;
+  }
   arg1 = cdr(arg1);
   arg2 = cdr(arg2);
   while ((arg1 != NULL) || (arg2 != NULL)) {
@@ -2842,29 +4958,15 @@ object *fn_sort (object *args, object *env) {
 object *fn_stringfn (object *args, object *env) {
   (void) env;
   object *arg = first(args);
-  int type = arg->type;
-  if (type == STRING) return arg;
-  object *obj = myalloc();
-  obj->type = STRING;
-  if (type == CHARACTER) {
-    object *cell = myalloc();
-    cell->car = NULL;
-    uint8_t shift = (sizeof(int)-1)*8;
-    cell->integer = (arg->integer)<<shift;
-    obj->cdr = cell;
-  } else if (type == SYMBOL) {
-    char *s = symbolname(arg->name);
-    char ch = *s++;
-    object *head = NULL;
-    int chars = 0;
-    while (ch) {
-      if (ch == '\\') ch = *s++;
-      buildstring(ch, &chars, &head);
-      ch = *s++;
-    }
-    obj->cdr = head;
-  } else error(STRINGFN, PSTR("can't convert to string"), arg);
-  return obj;
+  int type = arg->type;
+  if (stringp(arg)) return arg;
+  if (type == CHARACTER) {
+    char ch = arg->integer;
+    return makestring(STRINGFN, &ch, 1);
+  }
+  if (type == SYMBOL) return lispstring(symbolname(arg->name));
+  error(STRINGFN, PSTR("can't convert to string"), arg);
+  return nil;
 }
 
 object *fn_concatenate (object *args, object *env) {
@@ -2873,26 +4975,30 @@ object *fn_concatenate (object *args, object *env) {
   symbol_t name = arg->name;
   if (name != STRINGFN) error2(CONCATENATE, PSTR("only supports strings"));
   args = cdr(args);
-  object *result = myalloc();
-  result->type = STRING;
-  object *head = NULL;
-  int chars = 0;
-  while (args != NULL) {
-    object *obj = first(args);
-    if (obj->type != STRING) error(CONCATENATE, notastring, obj);
-    obj = cdr(obj);
-    while (obj != NULL) {
-      int quad = obj->integer;
-      while (quad != 0) {
-         char ch = quad>>((sizeof(int)-1)*8) & 0xFF;
-         buildstring(ch, &chars, &head);
-         quad = quad<<8;
-      }
-      obj = car(obj);
+  int length = 0;
+  for (object *list = args; list != NULL; list = cdr(list)) {
+    object *obj = first(list);
+    if (!stringp(obj)) error(CONCATENATE, notastring, obj);
+    length = length + stringlength(obj);
+  }
+  if (length <= SHORTSTRING) {
+    char buffer[SHORTSTRING+1];
+    int index = 0;
+    while (args != NULL) {
+      cstring(first(args), &buffer[index], SHORTSTRING+1-index);
+      index = index + stringlength(first(args));
+      args = cdr(args);
     }
+    return makestring(CONCATENATE, buffer, length);
+  }
+  object *result = makelongstring(CONCATENATE, NULL, length);
+  char *buffer = stringchars(result);
+  while (args != NULL) {
+    int n = stringlength(first(args));
+    cstring(first(args), buffer, n+1);
+    buffer = buffer + n;
     args = cdr(args);
   }
-  result->cdr = head;
   return result;
 }
 
@@ -2903,18 +5009,14 @@ object *fn_subseq (object *args, object *env) {
   int start = checkinteger(SUBSEQ, second(args));
   int end;
   args = cddr(args);
-  if (args != NULL) end = checkinteger(SUBSEQ, car(args)); else end = stringlength(arg);
-  object *result = myalloc();
-  result->type = STRING;
-  object *head = NULL;
-  int chars = 0;
-  for (int i=start; i<end; i++) {
-    char ch = nthchar(arg, i);
-    if (ch == 0) error2(SUBSEQ, PSTR("index out of range"));
-    buildstring(ch, &chars, &head);
-  }
-  result->cdr = head;
-  return result;
+  int length = stringlength(arg);
+  if (args != NULL) end = checkinteger(SUBSEQ, car(args)); else end = length;
+  if (start < 0 || end > length || start > end) error2(SUBSEQ, PSTR("index out of range"));
+  if (arg->type == LONGSTRING) return makestring(SUBSEQ, stringchars(arg) + start, end - start);
+  builder_t b;
+  startstring(SUBSEQ, &b, end - start);
+  for (int i=start; i<end; i++) appendchar(&b, nthchar(arg, i));
+  return finishstring(&b);
 }
 
 int gstr () {
@@ -2937,34 +5039,78 @@ object *fn_readfromstring (object *args, object *env) {
 }
 
 void pstr (char c) {
-  buildstring(c, &GlobalStringIndex, &GlobalString);
+  appendchar(GlobalBuilder, c);
+}
+
+// Prints to a string through pstr, keeping any enclosing build going
+
+object *printtostring (symbol_t name, object *arg) {
+  builder_t b, *outer = GlobalBuilder;
+  startstring(name, &b, 0);
+  GlobalBuilder = &b;
+  printobject(arg, pstr);
+  GlobalBuilder = outer;
+  return finishstring(&b);
 }
  
 object *fn_princtostring (object *args, object *env) {   
   (void) env;
-  object *arg = first(args);
-  object *obj = myalloc();
-  obj->type = STRING;
-  GlobalString = NULL;
-  GlobalStringIndex = 0;
   char temp = Flags;
   clrflag(PRINTREADABLY);
-  printobject(arg, pstr);
+  object *result = printtostring(PRINCTOSTRING, first(args));
   Flags = temp;
-  obj->cdr = GlobalString;
-  return obj;
+  return result;
 }
 
 object *fn_prin1tostring (object *args, object *env) {   
   (void) env;
-  object *arg = first(args);
-  object *obj = myalloc();
-  obj->type = STRING;
-  GlobalString = NULL;
-  GlobalStringIndex = 0;
-  printobject(arg, pstr);
-  obj->cdr = GlobalString;
-  return obj;
+  return printtostring(PRIN1TOSTRING, first(args));
+}
+
+// Vectors
+
+object *listvector (object *list) {
+  int length = listlength(0, list);
+  object *vector = makevector(0, length, nil, false);
+  object **elements = vectorelements(vector);
+  for (int i=0; i<length; i++) { elements[i] = car(list); list = cdr(list); }
+  return vector;
+}
+
+// Element type t, or (unsigned-byte 8) for a byte vector
+
+boolean bytetype (object *type) {
+  if (type == NULL || type == tee) return false;
+  if (consp(type) && namedp(first(type), "unsigned-byte") && consp(cdr(type)) &&
+    integerp(second(type)) && second(type)->integer == 8 && cddr(type) == NULL) return true;
+  error(MAKEARRAY, PSTR("unsupported element type"), type);
+  return false;
+}
+
+object *fn_makearray (object *args, object *env) {
+  (void) env;
+  object *size = first(args);
+  if (consp(size)) {
+    if (cdr(size) != NULL) error(MAKEARRAY, PSTR("only one dimension is supported"), size);
+    size = first(size);
+  }
+  static const char *const keys[] = { ":initial-element", ":element-type" };
+  object *values[2];
+  keywordargs(MAKEARRAY, cdr(args), keys, values, 2);
+  object *initial = values[0];
+  boolean bytes = bytetype(values[1]);
+  if (bytes && initial != NULL) checkbyte(MAKEARRAY, initial);
+  return makevector(MAKEARRAY, checkinteger(MAKEARRAY, size), initial, bytes);
+}
+
+object *fn_aref (object **args, object *env) {
+  (void) env;
+  return vectorref(args[0], vectorindex(AREF, args[0], args[1]));
+}
+
+object *fn_vectorp (object **args, object *env) {
+  (void) env;
+  return vectorp(args[0]) ? tee : nil;
 }
 
 // Bitwise operators
@@ -3041,6 +5187,7 @@ object *fn_makunbound (object *args, object *env) {
   (void) env;
   object *key = first(args);
   delassoc(key, &GlobalEnv);
+  indexglobals();
   return key;
 }
 
@@ -3102,6 +5249,34 @@ object *fn_readbyte (object *args, object *env) {
   return (c == -1) ? nil : number(c);
 }
 
+// The part of a vector given by the :start and :end keyword arguments
+
+void vectorrange (symbol_t name, object *vector, object *args, int *start, int *end) {
+  if (!vectorp(vector)) error(name, notavector, vector);
+  static const char *const keys[] = { ":start", ":end" };
+  object *values[2];
+  keywordargs(name, args, keys, values, 2);
+  int length = vectorlength(vector);
+  *start = (values[0] != NULL) ? checkinteger(name, values[0]) : 0;
+  *end = (values[1] != NULL) ? checkinteger(name, values[1]) : length;
+  if (*start < 0 || *start > *end || *end > length) error2(name, PSTR("index out of range"));
+}
+
+object *fn_readsequence (object *args, object *env) {
+  (void) env;
+  object *vector = first(args);
+  int start, end;
+  vectorrange(READSEQUENCE, vector, cddr(args), &start, &end);
+  if (bytevectorp(vector)) return number(start + readbytes(cdr(args), vectorbytes(vector) + start, end - start));
+  gfun_t gfun = gstreamfun(cdr(args));
+  while (start < end) {
+    int c = gfun();
+    if (c == -1) break;
+    vectorelements(vector)[start++] = number(c);
+  }
+  return number(start);
+}
+
 object *fn_readline (object *args, object *env) {
   (void) env;
   gfun_t gfun = gstreamfun(args);
@@ -3116,6 +5291,19 @@ object *fn_writebyte (object *args, object *env) {
   return nil;
 }
 
+object *fn_writesequence (object *args, object *env) {
+  (void) env;
+  object *vector = first(args);
+  int start, end;
+  vectorrange(WRITESEQUENCE, vector, cddr(args), &start, &end);
+  if (bytevectorp(vector)) writebytes(cdr(args), vectorbytes(vector) + start, end - start);
+  else {
+    pfun_t pfun = pstreamfun(cdr(args));
+    for (int i=start; i<end; i++) pfun(checkbyte(WRITESEQUENCE, vectorelements(vector)[i]));
+  }
+  return vector;
+}
+
 object *fn_writestring (object *args, object *env) {
   (void) env;
   object *obj = first(args);
@@ -3347,19 +5535,19 @@ void superprint (object *form, int lm, pfun_t pfun) {
 }
 
 const int ppspecials = 17;
-const char ppspecial[ppspecials] PROGMEM = 
+const uint8_t ppspecial[ppspecials] PROGMEM = 
   { DOTIMES, DOLIST, IF, SETQ, TEE, LET, LETSTAR, LAMBDA, WHEN, UNLESS, WITHI2C, WITHSERIAL, WITHSPI, WITHSDCARD, WITHSPIFFS, FORMILLIS, WITHCLIENT };
 
 void supersub (object *form, int lm, int super, pfun_t pfun) {
   int special = 0, separate = 1;
   object *arg = car(form);
   if (symbolp(arg)) {
-    int name = arg->name;
+    symbol_t name = arg->name;
     if (name == DEFUN) special = 2;
     else for (int i=0; i<ppspecials; i++) {
       if (name == ppspecial[i]) { special = 1; break; }   
     } 
-  }
+  } else if (codep(arg)) special = 1;
   while (form != NULL) {
     if (atom(form)) { pfstring(PSTR(" . "), pfun); printobject(form, pfun); pfun(')'); return; }
     else if (separate) { pfun('('); separate = 0; }
@@ -3389,8 +5577,10 @@ object *fn_pprintall (object *args, object *env) {
     object *var = car(pair);
     object *val = cdr(pair);
     pln(pserial);
-    if (consp(val) && symbolp(car(val)) && car(val)->name == LAMBDA) {
+    if (lambdap(val)) {
       superprint(cons(symbol(DEFUN), cons(var, cdr(val))), 0, pserial);
+    } else if (macrop(val)) {
+      superprint(cons(symbol(DEFMACRO), cons(var, cddr(val))), 0, pserial);
     } else {
       superprint(cons(symbol(DEFVAR),cons(var,cons(cons(symbol(QUOTE),cons(val,NULL))
       ,NULL))), 0, pserial);
@@ -3405,19 +5595,13 @@ object *fn_pprintall (object *args, object *env) {
 
 object *fn_require (object *args, object *env) {
   object *arg = first(args);
-  object *globals = GlobalEnv;
   if (!symbolp(arg)) error(REQUIRE, PSTR("argument is not a symbol"), arg);
-  while (globals != NULL) {
-    object *pair = first(globals);
-    object *var = car(pair);
-    if (symbolp(var) && var == arg) return nil;
-    globals = cdr(globals);
-  }
+  if (globalvalue(arg->name) != NULL) return nil;
   GlobalStringIndex = 0;
   object *line = read(glibrary);
   while (line != NULL) {
     // Is this the definition we want
-    int fname = first(line)->name;
+    symbol_t fname = first(line)->name;
     if ((fname == DEFUN || fname == DEFVAR) && symbolp(second(line)) && second(line)->name == arg->name) {
       eval(line, env);
       return tee;
@@ -3432,7 +5616,7 @@ object *fn_listlibrary (object *args, object *env) {
   GlobalStringIndex = 0;
   object *line = read(glibrary);
   while (line != NULL) {
-    int fname = first(line)->name;
+    symbol_t fname = first(line)->name;
     if (fname == DEFUN || fname == DEFVAR) {
       pstring(symbolname(second(line)->name), pserial); pserial(' ');
     }
@@ -3501,8 +5685,71 @@ object *fn_wificonnect (object *args, object *env) {
   return nil;
 }
 
+// Native functions - the C translations made by tools/lisp2c.py call these
+
+// Reserves a frame of stack slots, which the garbage collector marks, for the variables of a native function
+
+inline unsigned int nativeframe (unsigned int slots) {
+  unsigned int fp = StackTop;
+  growstack(fp + slots);
+  for (unsigned int i=fp; i<fp+slots; i++) Stack[i] = nil;
+  StackTop = fp + slots;
+  return fp;
+}
+
+inline object *nativefixed (fn_fixed_type fn, object *a = NULL, object *b = NULL, object *c = NULL) {
+  object *array[3] = { a, b, c };
+  return fn(array, NULL);
+}
+
+// Two-argument arithmetic and comparisons, with fixnums handled inline and anything else by the builtin
+
+inline boolean nativeoverflow (symbol_t op, int a, int b, int *r) {
+  switch (op) {
+    case ADD: return addoverflow(a, b, r);
+    case SUBTRACT: return subtractoverflow(a, b, r);
+    default: return multiplyoverflow(a, b, r);
+  }
+}
+
+inline object *nativearith (symbol_t op, object *a, object *b) {
+  int r;
+  if (integerp(a) && integerp(b) && !nativeoverflow(op, a->integer, b->integer, &r)) return number(r);
+  return nativefixed(lookupfixed(op), a, b);
+}
+
+inline object *nativearithint (symbol_t op, object *a, int b) {
+  int r;
+  if (integerp(a) && !nativeoverflow(op, a->integer, b, &r)) return number(r);
+  return nativearith(op, a, number(b));
+}
+
+inline boolean nativecompare (symbol_t op, int a, int b) {
+  switch (op) {
+    case NUMEQ: return a == b;
+    case NOTEQ: return a != b;
+    case LESS: return a < b;
+    case LESSEQ: return a <= b;
+    case GREATER: return a > b;
+    default: return a >= b;
+  }
+}
+
+inline boolean nativetest (symbol_t op, object *a, object *b) {
+  if (integerp(a) && integerp(b)) return nativecompare(op, a->integer, b->integer);
+  return nativefixed(lookupfixed(op), a, b) != nil;
+}
+
+inline boolean nativetestint (symbol_t op, object *a, int b) {
+  if (integerp(a)) return nativecompare(op, a->integer, b);
+  return nativetest(op, a, number(b));
+}
+
 // Insert your own function definitions here
 
+#define MODULEDEFINITIONS
+#include "Modules.h"
+
 // Built-in procedure names - stored in PROGMEM
 
 const char string0[] PROGMEM = "nil";
@@ -3514,403 +5761,536 @@ const char string5[] PROGMEM = "lambda";
 const char string6[] PROGMEM = "let";
 const char string7[] PROGMEM = "let*";
 const char string8[] PROGMEM = "closure";
-const char string9[] PROGMEM = "special_forms";
-const char string10[] PROGMEM = "quote";
-const char string11[] PROGMEM = "defun";
-const char string12[] PROGMEM = "defvar";
-const char string13[] PROGMEM = "setq";
-const char string14[] PROGMEM = "loop";
-const char string15[] PROGMEM = "return";
-const char string16[] PROGMEM = "push";
-const char string17[] PROGMEM = "pop";
-const char string18[] PROGMEM = "incf";
-const char string19[] PROGMEM = "decf";
-const char string20[] PROGMEM = "setf";
-const char string21[] PROGMEM = "dolist";
-const char string22[] PROGMEM = "dotimes";
-const char string23[] PROGMEM = "trace";
-const char string24[] PROGMEM = "untrace";
-const char string25[] PROGMEM = "for-millis";
-const char string26[] PROGMEM = "with-serial";
-const char string27[] PROGMEM = "with-i2c";
-const char string28[] PROGMEM = "with-spi";
-const char string29[] PROGMEM = "with-sd-card";
+const char string9[] PROGMEM = "macro";
+const char string10[] PROGMEM = "special_forms";
+const char string11[] PROGMEM = "quote";
+const char string12[] PROGMEM = "defun";
+const char string13[] PROGMEM = "defmacro";
+const char string14[] PROGMEM = "defvar";
+const char string15[] PROGMEM = "setq";
+const char string16[] PROGMEM = "loop";
+const char string17[] PROGMEM = "return";
+const char string18[] PROGMEM = "push";
+const char string19[] PROGMEM = "pop";
+const char string20[] PROGMEM = "incf";
+const char string21[] PROGMEM = "decf";
+const char string22[] PROGMEM = "setf";
+const char string23[] PROGMEM = "dolist";
+const char string24[] PROGMEM = "dotimes";
+const char string25[] PROGMEM = "trace";
+const char string26[] PROGMEM = "untrace";
+const char string27[] PROGMEM = "for-millis";
+const char string28[] PROGMEM = "with-serial";
+const char string29[] PROGMEM = "with-i2c";
+const char string30[] PROGMEM = "with-spi";
+const char string31[] PROGMEM = "with-sd-card";
 const char string2A[] PROGMEM = "with-spiffs";
-const char string30[] PROGMEM = "with-client";
-const char string31[] PROGMEM = "tail_forms";
-const char string32[] PROGMEM = "progn";
-const char string33[] PROGMEM = "if";
-const char string34[] PROGMEM = "cond";
-const char string35[] PROGMEM = "when";
-const char string36[] PROGMEM = "unless";
-const char string37[] PROGMEM = "case";
-const char string38[] PROGMEM = "and";
-const char string39[] PROGMEM = "or";
-const char string40[] PROGMEM = "functions";
-const char string41[] PROGMEM = "not";
-const char string42[] PROGMEM = "null";
-const char string43[] PROGMEM = "cons";
-const char string44[] PROGMEM = "atom";
-const char string45[] PROGMEM = "listp";
-const char string46[] PROGMEM = "consp";
-const char string47[] PROGMEM = "symbolp";
-const char string48[] PROGMEM = "streamp";
-const char string49[] PROGMEM = "eq";
-const char string50[] PROGMEM = "car";
-const char string51[] PROGMEM = "first";
-const char string52[] PROGMEM = "cdr";
-const char string53[] PROGMEM = "rest";
-const char string54[] PROGMEM = "caar";
-const char string55[] PROGMEM = "cadr";
-const char string56[] PROGMEM = "second";
-const char string57[] PROGMEM = "cdar";
-const char string58[] PROGMEM = "cddr";
-const char string59[] PROGMEM = "caaar";
-const char string60[] PROGMEM = "caadr";
-const char string61[] PROGMEM = "cadar";
-const char string62[] PROGMEM = "caddr";
-const char string63[] PROGMEM = "third";
-const char string64[] PROGMEM = "cdaar";
-const char string65[] PROGMEM = "cdadr";
-const char string66[] PROGMEM = "cddar";
-const char string67[] PROGMEM = "cdddr";
-const char string68[] PROGMEM = "length";
-const char string69[] PROGMEM = "list";
-const char string70[] PROGMEM = "reverse";
-const char string71[] PROGMEM = "nth";
-const char string72[] PROGMEM = "assoc";
-const char string73[] PROGMEM = "member";
-const char string74[] PROGMEM = "apply";
-const char string75[] PROGMEM = "funcall";
-const char string76[] PROGMEM = "append";
-const char string77[] PROGMEM = "mapc";
-const char string78[] PROGMEM = "mapcar";
-const char string79[] PROGMEM = "mapcan";
-const char string80[] PROGMEM = "+";
-const char string81[] PROGMEM = "-";
-const char string82[] PROGMEM = "*";
-const char string83[] PROGMEM = "/";
-const char string84[] PROGMEM = "mod";
-const char string85[] PROGMEM = "1+";
-const char string86[] PROGMEM = "1-";
-const char string87[] PROGMEM = "abs";
-const char string88[] PROGMEM = "random";
-const char string89[] PROGMEM = "max";
-const char string90[] PROGMEM = "min";
-const char string91[] PROGMEM = "/=";
-const char string92[] PROGMEM = "=";
-const char string93[] PROGMEM = "<";
-const char string94[] PROGMEM = "<=";
-const char string95[] PROGMEM = ">";
-const char string96[] PROGMEM = ">=";
-const char string97[] PROGMEM = "plusp";
-const char string98[] PROGMEM = "minusp";
-const char string99[] PROGMEM = "zerop";
-const char string100[] PROGMEM = "oddp";
-const char string101[] PROGMEM = "evenp";
-const char string102[] PROGMEM = "integerp";
-const char string103[] PROGMEM = "numberp";
-const char string104[] PROGMEM = "float";
-const char string105[] PROGMEM = "floatp";
-const char string106[] PROGMEM = "sin";
-const char string107[] PROGMEM = "cos";
-const char string108[] PROGMEM = "tan";
-const char string109[] PROGMEM = "asin";
-const char string110[] PROGMEM = "acos";
-const char string111[] PROGMEM = "atan";
-const char string112[] PROGMEM = "sinh";
-const char string113[] PROGMEM = "cosh";
-const char string114[] PROGMEM = "tanh";
-const char string115[] PROGMEM = "exp";
-const char string116[] PROGMEM = "sqrt";
-const char string117[] PROGMEM = "log";
-const char string118[] PROGMEM = "expt";
-const char string119[] PROGMEM = "ceiling";
-const char string120[] PROGMEM = "floor";
-const char string121[] PROGMEM = "truncate";
-const char string122[] PROGMEM = "round";
-const char string123[] PROGMEM = "char";
-const char string124[] PROGMEM = "char-code";
-const char string125[] PROGMEM = "code-char";
-const char string126[] PROGMEM = "characterp";
-const char string127[] PROGMEM = "stringp";
-const char string128[] PROGMEM = "string=";
-const char string129[] PROGMEM = "string<";
-const char string130[] PROGMEM = "string>";
-const char string131[] PROGMEM = "sort";
-const char string132[] PROGMEM = "string";
-const char string133[] PROGMEM = "concatenate";
-const char string134[] PROGMEM = "subseq";
-const char string135[] PROGMEM = "read-from-string";
-const char string136[] PROGMEM = "princ-to-string";
-const char string137[] PROGMEM = "prin1-to-string";
-const char string138[] PROGMEM = "logand";
-const char string139[] PROGMEM = "logior";
-const char string140[] PROGMEM = "logxor";
-const char string141[] PROGMEM = "lognot";
-const char string142[] PROGMEM = "ash";
-const char string143[] PROGMEM = "logbitp";
-const char string144[] PROGMEM = "eval";
-const char string145[] PROGMEM = "globals";
-const char string146[] PROGMEM = "locals";
-const char string147[] PROGMEM = "makunbound";
-const char string148[] PROGMEM = "break";
-const char string149[] PROGMEM = "read";
-const char string150[] PROGMEM = "prin1";
-const char string151[] PROGMEM = "print";
-const char string152[] PROGMEM = "princ";
-const char string153[] PROGMEM = "terpri";
-const char string154[] PROGMEM = "read-byte";
-const char string155[] PROGMEM = "read-line";
-const char string156[] PROGMEM = "write-byte";
-const char string157[] PROGMEM = "write-string";
-const char string158[] PROGMEM = "write-line";
-const char string159[] PROGMEM = "restart-i2c";
-const char string160[] PROGMEM = "gc";
-const char string161[] PROGMEM = "room";
-const char string162[] PROGMEM = "save-image";
-const char string163[] PROGMEM = "load-image";
-const char string164[] PROGMEM = "cls";
-const char string165[] PROGMEM = "pinmode";
-const char string166[] PROGMEM = "digitalread";
-const char string167[] PROGMEM = "digitalwrite";
-const char string168[] PROGMEM = "analogread";
-const char string169[] PROGMEM = "analogwrite";
-const char string170[] PROGMEM = "delay";
-const char string171[] PROGMEM = "millis";
-const char string172[] PROGMEM = "sleep";
-const char string173[] PROGMEM = "note";
-const char string174[] PROGMEM = "edit";
-const char string175[] PROGMEM = "pprint";
-const char string176[] PROGMEM = "pprintall";
-const char string177[] PROGMEM = "require";
-const char string178[] PROGMEM = "list-library";
-const char string179[] PROGMEM = "available";
-const char string180[] PROGMEM = "wifi-server";
-const char string181[] PROGMEM = "wifi-softap";
-const char string182[] PROGMEM = "connected";
-const char string183[] PROGMEM = "wifi-localip";
-const char string184[] PROGMEM = "wifi-connect";
+const char string32[] PROGMEM = "with-client";
+const char string33[] PROGMEM = "declare";
+const char string34[] PROGMEM = "tail_forms";
+const char string35[] PROGMEM = "progn";
+const char string36[] PROGMEM = "if";
+const char string37[] PROGMEM = "cond";
+const char string38[] PROGMEM = "when";
+const char string39[] PROGMEM = "unless";
+const char string40[] PROGMEM = "case";
+const char string41[] PROGMEM = "and";
+const char string42[] PROGMEM = "or";
+const char string43[] PROGMEM = "functions";
+const char string44[] PROGMEM = "not";
+const char string45[] PROGMEM = "null";
+const char string46[] PROGMEM = "cons";
+const char string47[] PROGMEM = "atom";
+const char string48[] PROGMEM = "listp";
+const char string49[] PROGMEM = "consp";
+const char string50[] PROGMEM = "symbolp";
+const char string51[] PROGMEM = "streamp";
+const char string52[] PROGMEM = "eq";
+const char string53[] PROGMEM = "car";
+const char string54[] PROGMEM = "first";
+const char string55[] PROGMEM = "cdr";
+const char string56[] PROGMEM = "rest";
+const char string57[] PROGMEM = "caar";
+const char string58[] PROGMEM = "cadr";
+const char string59[] PROGMEM = "second";
+const char string60[] PROGMEM = "cdar";
+const char string61[] PROGMEM = "cddr";
+const char string62[] PROGMEM = "caaar";
+const char string63[] PROGMEM = "caadr";
+const char string64[] PROGMEM = "cadar";
+const char string65[] PROGMEM = "caddr";
+const char string66[] PROGMEM = "third";
+const char string67[] PROGMEM = "cdaar";
+const char string68[] PROGMEM = "cdadr";
+const char string69[] PROGMEM = "cddar";
+const char string70[] PROGMEM = "cdddr";
+const char string71[] PROGMEM = "length";
+const char string72[] PROGMEM = "list";
+const char string73[] PROGMEM = "reverse";
+const char string74[] PROGMEM = "nth";
+const char string75[] PROGMEM = "assoc";
+const char string76[] PROGMEM = "member";
+const char string77[] PROGMEM = "apply";
+const char string78[] PROGMEM = "funcall";
+const char string79[] PROGMEM = "append";
+const char string80[] PROGMEM = "mapc";
+const char string81[] PROGMEM = "mapcar";
+const char string82[] PROGMEM = "mapcan";
+const char string83[] PROGMEM = "+";
+const char string84[] PROGMEM = "-";
+const char string85[] PROGMEM = "*";
+const char string86[] PROGMEM = "/";
+const char string87[] PROGMEM = "mod";
+const char string88[] PROGMEM = "1+";
+const char string89[] PROGMEM = "1-";
+const char string90[] PROGMEM = "abs";
+const char string91[] PROGMEM = "random";
+const char string92[] PROGMEM = "max";
+const char string93[] PROGMEM = "min";
+const char string94[] PROGMEM = "/=";
+const char string95[] PROGMEM = "=";
+const char string96[] PROGMEM = "<";
+const char string97[] PROGMEM = "<=";
+const char string98[] PROGMEM = ">";
+const char string99[] PROGMEM = ">=";
+const char string100[] PROGMEM = "plusp";
+const char string101[] PROGMEM = "minusp";
+const char string102[] PROGMEM = "zerop";
+const char string103[] PROGMEM = "oddp";
+const char string104[] PROGMEM = "evenp";
+const char string105[] PROGMEM = "integerp";
+const char string106[] PROGMEM = "numberp";
+const char string107[] PROGMEM = "float";
+const char string108[] PROGMEM = "floatp";
+const char string109[] PROGMEM = "sin";
+const char string110[] PROGMEM = "cos";
+const char string111[] PROGMEM = "tan";
+const char string112[] PROGMEM = "asin";
+const char string113[] PROGMEM = "acos";
+const char string114[] PROGMEM = "atan";
+const char string115[] PROGMEM = "sinh";
+const char string116[] PROGMEM = "cosh";
+const char string117[] PROGMEM = "tanh";
+const char string118[] PROGMEM = "exp";
+const char string119[] PROGMEM = "sqrt";
+const char string120[] PROGMEM = "log";
+const char string121[] PROGMEM = "expt";
+const char string122[] PROGMEM = "ceiling";
+const char string123[] PROGMEM = "floor";
+const char string124[] PROGMEM = "truncate";
+const char string125[] PROGMEM = "round";
+const char string126[] PROGMEM = "char";
+const char string127[] PROGMEM = "char-code";
+const char string128[] PROGMEM = "code-char";
+const char string129[] PROGMEM = "characterp";
+const char string130[] PROGMEM = "stringp";
+const char string131[] PROGMEM = "string=";
+const char string132[] PROGMEM = "string<";
+const char string133[] PROGMEM = "string>";
+const char string134[] PROGMEM = "sort";
+const char string135[] PROGMEM = "string";
+const char string136[] PROGMEM = "concatenate";
+const char string137[] PROGMEM = "subseq";
+const char string138[] PROGMEM = "read-from-string";
+const char string139[] PROGMEM = "princ-to-string";
+const char string140[] PROGMEM = "prin1-to-string";
+const char string141[] PROGMEM = "logand";
+const char string142[] PROGMEM = "logior";
+const char string143[] PROGMEM = "logxor";
+const char string144[] PROGMEM = "lognot";
+const char string145[] PROGMEM = "ash";
+const char string146[] PROGMEM = "logbitp";
+const char string147[] PROGMEM = "eval";
+const char string148[] PROGMEM = "globals";
+const char string149[] PROGMEM = "locals";
+const char string150[] PROGMEM = "makunbound";
+const char string151[] PROGMEM = "break";
+const char string152[] PROGMEM = "read";
+const char string153[] PROGMEM = "prin1";
+const char string154[] PROGMEM = "print";
+const char string155[] PROGMEM = "princ";
+const char string156[] PROGMEM = "terpri";
+const char string157[] PROGMEM = "read-byte";
+const char string158[] PROGMEM = "read-line";
+const char string159[] PROGMEM = "write-byte";
+const char string160[] PROGMEM = "write-string";
+const char string161[] PROGMEM = "write-line";
+const char string162[] PROGMEM = "restart-i2c";
+const char string163[] PROGMEM = "gc";
+const char string164[] PROGMEM = "room";
+const char string165[] PROGMEM = "save-image";
+const char string166[] PROGMEM = "load-image";
+const char string167[] PROGMEM = "cls";
+const char string168[] PROGMEM = "pinmode";
+const char string169[] PROGMEM = "digitalread";
+const char string170[] PROGMEM = "digitalwrite";
+const char string171[] PROGMEM = "analogread";
+const char string172[] PROGMEM = "analogwrite";
+const char string173[] PROGMEM = "delay";
+const char string174[] PROGMEM = "millis";
+const char string175[] PROGMEM = "sleep";
+const char string176[] PROGMEM = "note";
+const char string177[] PROGMEM = "edit";
+const char string178[] PROGMEM = "pprint";
+const char string179[] PROGMEM = "pprintall";
+const char string180[] PROGMEM = "require";
+const char string181[] PROGMEM = "list-library";
+const char string182[] PROGMEM = "available";
+const char string183[] PROGMEM = "wifi-server";
+const char string184[] PROGMEM = "wifi-softap";
+const char string185[] PROGMEM = "connected";
+const char string186[] PROGMEM = "wifi-localip";
+const char string187[] PROGMEM = "wifi-connect";
+const char string188[] PROGMEM = "make-array";
+const char string189[] PROGMEM = "aref";
+const char string190[] PROGMEM = "vectorp";
+const char string191[] PROGMEM = "read-sequence";
+const char string192[] PROGMEM = "write-sequence";
+#define MODULESTRING(name, lispname, fptr, fixed, min, max) const char string##name[] PROGMEM = lispname;
+MODULEFUNCTIONS(MODULESTRING)
 
 const tbl_entry_t lookup_table[] PROGMEM = {
-  { string0, NULL, 0, 0 },
-  { string1, NULL, 0, 0 },
-  { string2, NULL, 0, 0 },
-  { string3, NULL, 0, 0 },
-  { string4, NULL, 0, 0 },
-  { string5, NULL, 0, 127 },
-  { string6, NULL, 0, 127 },
-  { string7, NULL, 0, 127 },
-  { string8, NULL, 0, 127 },
-  { string9, NULL, NIL, NIL },
-  { string10, sp_quote, 1, 1 },
-  { string11, sp_defun, 0, 127 },
-  { string12, sp_defvar, 2, 2 },
-  { string13, sp_setq, 2, 126 },
-  { string14, sp_loop, 0, 127 },
-  { string15, sp_return, 0, 127 },
-  { string16, sp_push, 2, 2 },
-  { string17, sp_pop, 1, 1 },
-  { string18, sp_incf, 1, 2 },
-  { string19, sp_decf, 1, 2 },
-  { string20, sp_setf, 2, 126 },
-  { string21, sp_dolist, 1, 127 },
-  { string22, sp_dotimes, 1, 127 },
-  { string23, sp_trace, 0, 1 },
-  { string24, sp_untrace, 0, 1 },
-  { string25, sp_formillis, 1, 127 },
-  { string26, sp_withserial, 1, 127 },
-  { string27, sp_withi2c, 1, 127 },
-  { string28, sp_withspi, 1, 127 },
-  { string29, sp_withsdcard, 2, 127 },
-  { string2A, sp_withspiffs, 2, 127 },
-  { string30, sp_withclient, 1, 2 },
-  { string31, NULL, NIL, NIL },
-  { string32, tf_progn, 0, 127 },
-  { string33, tf_if, 2, 3 },
-  { string34, tf_cond, 0, 127 },
-  { string35, tf_when, 1, 127 },
-  { string36, tf_unless, 1, 127 },
-  { string37, tf_case, 1, 127 },
-  { string38, tf_and, 0, 127 },
-  { string39, tf_or, 0, 127 },
-  { string40, NULL, NIL, NIL },
-  { string41, fn_not, 1, 1 },
-  { string42, fn_not, 1, 1 },
-  { string43, fn_cons, 2, 2 },
-  { string44, fn_atom, 1, 1 },
-  { string45, fn_listp, 1, 1 },
-  { string46, fn_consp, 1, 1 },
-  { string47, fn_symbolp, 1, 1 },
-  { string48, fn_streamp, 1, 1 },
-  { string49, fn_eq, 2, 2 },
-  { string50, fn_car, 1, 1 },
-  { string51, fn_car, 1, 1 },
-  { string52, fn_cdr, 1, 1 },
-  { string53, fn_cdr, 1, 1 },
-  { string54, fn_caar, 1, 1 },
-  { string55, fn_cadr, 1, 1 },
-  { string56, fn_cadr, 1, 1 },
-  { string57, fn_cdar, 1, 1 },
-  { string58, fn_cddr, 1, 1 },
-  { string59, fn_caaar, 1, 1 },
-  { string60, fn_caadr, 1, 1 },
-  { string61, fn_cadar, 1, 1 },
-  { string62, fn_caddr, 1, 1 },
-  { string63, fn_caddr, 1, 1 },
-  { string64, fn_cdaar, 1, 1 },
-  { string65, fn_cdadr, 1, 1 },
-  { string66, fn_cddar, 1, 1 },
-  { string67, fn_cdddr, 1, 1 },
-  { string68, fn_length, 1, 1 },
-  { string69, fn_list, 0, 127 },
-  { string70, fn_reverse, 1, 1 },
-  { string71, fn_nth, 2, 2 },
-  { string72, fn_assoc, 2, 2 },
-  { string73, fn_member, 2, 2 },
-  { string74, fn_apply, 2, 127 },
-  { string75, fn_funcall, 1, 127 },
-  { string76, fn_append, 0, 127 },
-  { string77, fn_mapc, 2, 127 },
-  { string78, fn_mapcar, 2, 127 },
-  { string79, fn_mapcan, 2, 127 },
-  { string80, fn_add, 0, 127 },
-  { string81, fn_subtract, 1, 127 },
-  { string82, fn_multiply, 0, 127 },
-  { string83, fn_divide, 1, 127 },
-  { string84, fn_mod, 2, 2 },
-  { string85, fn_oneplus, 1, 1 },
-  { string86, fn_oneminus, 1, 1 },
-  { string87, fn_abs, 1, 1 },
-  { string88, fn_random, 1, 1 },
-  { string89, fn_maxfn, 1, 127 },
-  { string90, fn_minfn, 1, 127 },
-  { string91, fn_noteq, 1, 127 },
-  { string92, fn_numeq, 1, 127 },
-  { string93, fn_less, 1, 127 },
-  { string94, fn_lesseq, 1, 127 },
-  { string95, fn_greater, 1, 127 },
-  { string96, fn_greatereq, 1, 127 },
-  { string97, fn_plusp, 1, 1 },
-  { string98, fn_minusp, 1, 1 },
-  { string99, fn_zerop, 1, 1 },
-  { string100, fn_oddp, 1, 1 },
-  { string101, fn_evenp, 1, 1 },
-  { string102, fn_integerp, 1, 1 },
-  { string103, fn_numberp, 1, 1 },
-  { string104, fn_floatfn, 1, 1 },
-  { string105, fn_floatp, 1, 1 },
-  { string106, fn_sin, 1, 1 },
-  { string107, fn_cos, 1, 1 },
-  { string108, fn_tan, 1, 1 },
-  { string109, fn_asin, 1, 1 },
-  { string110, fn_acos, 1, 1 },
-  { string111, fn_atan, 1, 2 },
-  { string112, fn_sinh, 1, 1 },
-  { string113, fn_cosh, 1, 1 },
-  { string114, fn_tanh, 1, 1 },
-  { string115, fn_exp, 1, 1 },
-  { string116, fn_sqrt, 1, 1 },
-  { string117, fn_log, 1, 2 },
-  { string118, fn_expt, 2, 2 },
-  { string119, fn_ceiling, 1, 2 },
-  { string120, fn_floor, 1, 2 },
-  { string121, fn_truncate, 1, 2 },
-  { string122, fn_round, 1, 2 },
-  { string123, fn_char, 2, 2 },
-  { string124, fn_charcode, 1, 1 },
-  { string125, fn_codechar, 1, 1 },
-  { string126, fn_characterp, 1, 1 },
-  { string127, fn_stringp, 1, 1 },
-  { string128, fn_stringeq, 2, 2 },
-  { string129, fn_stringless, 2, 2 },
-  { string130, fn_stringgreater, 2, 2 },
-  { string131, fn_sort, 2, 2 },
-  { string132, fn_stringfn, 1, 1 },
-  { string133, fn_concatenate, 1, 127 },
-  { string134, fn_subseq, 2, 3 },
-  { string135, fn_readfromstring, 1, 1 },
-  { string136, fn_princtostring, 1, 1 },
-  { string137, fn_prin1tostring, 1, 1 },
-  { string138, fn_logand, 0, 127 },
-  { string139, fn_logior, 0, 127 },
-  { string140, fn_logxor, 0, 127 },
-  { string141, fn_lognot, 1, 1 },
-  { string142, fn_ash, 2, 2 },
-  { string143, fn_logbitp, 2, 2 },
-  { string144, fn_eval, 1, 1 },
-  { string145, fn_globals, 0, 0 },
-  { string146, fn_locals, 0, 0 },
-  { string147, fn_makunbound, 1, 1 },
-  { string148, fn_break, 0, 0 },
-  { string149, fn_read, 0, 1 },
-  { string150, fn_prin1, 1, 2 },
-  { string151, fn_print, 1, 2 },
-  { string152, fn_princ, 1, 2 },
-  { string153, fn_terpri, 0, 1 },
-  { string154, fn_readbyte, 0, 2 },
-  { string155, fn_readline, 0, 1 },
-  { string156, fn_writebyte, 1, 2 },
-  { string157, fn_writestring, 1, 2 },
-  { string158, fn_writeline, 1, 2 },
-  { string159, fn_restarti2c, 1, 2 },
-  { string160, fn_gc, 0, 0 },
-  { string161, fn_room, 0, 0 },
-  { string162, fn_saveimage, 0, 1 },
-  { string163, fn_loadimage, 0, 1 },
-  { string164, fn_cls, 0, 0 },
-  { string165, fn_pinmode, 2, 2 },
-  { string166, fn_digitalread, 1, 1 },
-  { string167, fn_digitalwrite, 2, 2 },
-  { string168, fn_analogread, 1, 1 },
-  { string169, fn_analogwrite, 2, 2 },
-  { string170, fn_delay, 1, 1 },
-  { string171, fn_millis, 0, 0 },
-  { string172, fn_sleep, 1, 1 },
-  { string173, fn_note, 0, 3 },
-  { string174, fn_edit, 1, 1 },
-  { string175, fn_pprint, 1, 2 },
-  { string176, fn_pprintall, 0, 0 },
-  { string177, fn_require, 1, 1 },
-  { string178, fn_listlibrary, 0, 0 },
-  { string179, fn_available, 1, 1 },
-  { string180, fn_wifiserver, 0, 0 },
-  { string181, fn_wifisoftap, 0, 4 },
-  { string182, fn_connected, 1, 1 },
-  { string183, fn_wifilocalip, 0, 0 },
-  { string184, fn_wificonnect, 0, 2 },
+  { string0, NULL, 0, 0, NULL },
+  { string1, NULL, 0, 0, NULL },
+  { string2, NULL, 0, 0, NULL },
+  { string3, NULL, 0, 0, NULL },
+  { string4, NULL, 0, 0, NULL },
+  { string5, NULL, 0, 127, NULL },
+  { string6, NULL, 0, 127, NULL },
+  { string7, NULL, 0, 127, NULL },
+  { string8, NULL, 0, 127, NULL },
+  { string9, NULL, 0, 127, NULL },
+  { string10, NULL, NIL, NIL, NULL },
+  { string11, sp_quote, 1, 1, NULL },
+  { string12, sp_defun, 0, 127, NULL },
+  { string13, sp_defmacro, 0, 127, NULL },
+  { string14, sp_defvar, 2, 2, NULL },
+  { string15, sp_setq, 2, 126, NULL },
+  { string16, sp_loop, 0, 127, NULL },
+  { string17, sp_return, 0, 127, NULL },
+  { string18, sp_push, 2, 2, NULL },
+  { string19, sp_pop, 1, 1, NULL },
+  { string20, sp_incf, 1, 2, NULL },
+  { string21, sp_decf, 1, 2, NULL },
+  { string22, sp_setf, 2, 126, NULL },
+  { string23, sp_dolist, 1, 127, NULL },
+  { string24, sp_dotimes, 1, 127, NULL },
+  { string25, sp_trace, 0, 1, NULL },
+  { string26, sp_untrace, 0, 1, NULL },
+  { string27, sp_formillis, 1, 127, NULL },
+  { string28, sp_withserial, 1, 127, NULL },
+  { string29, sp_withi2c, 1, 127, NULL },
+  { string30, sp_withspi, 1, 127, NULL },
+  { string31, sp_withsdcard, 2, 127, NULL },
+  { string2A, sp_withspiffs, 2, 127, NULL },
+  { string32, sp_withclient, 1, 2, NULL },
+  { string33, sp_declare, 0, 127, NULL },
+  { string34, NULL, NIL, NIL, NULL },
+  { string35, tf_progn, 0, 127, NULL },
+  { string36, tf_if, 2, 3, NULL },
+  { string37, tf_cond, 0, 127, NULL },
+  { string38, tf_when, 1, 127, NULL },
+  { string39, tf_unless, 1, 127, NULL },
+  { string40, tf_case, 1, 127, NULL },
+  { string41, tf_and, 0, 127, NULL },
+  { string42, tf_or, 0, 127, NULL },
+  { string43, NULL, NIL, NIL, NULL },
+  { string44, NULL, 1, 1, fn_not },
+  { string45, NULL, 1, 1, fn_not },
+  { string46, NULL, 2, 2, fn_cons },
+  { string47, NULL, 1, 1, fn_atom },
+  { string48, NULL, 1, 1, fn_listp },
+  { string49, NULL, 1, 1, fn_consp },
+  { string50, NULL, 1, 1, fn_symbolp },
+  { string51, NULL, 1, 1, fn_streamp },
+  { string52, NULL, 2, 2, fn_eq },
+  { string53, NULL, 1, 1, fn_car },
+  { string54, NULL, 1, 1, fn_car },
+  { string55, NULL, 1, 1, fn_cdr },
+  { string56, NULL, 1, 1, fn_cdr },
+  { string57, NULL, 1, 1, fn_caar },
+  { string58, NULL, 1, 1, fn_cadr },
+  { string59, NULL, 1, 1, fn_cadr },
+  { string60, NULL, 1, 1, fn_cdar },
+  { string61, NULL, 1, 1, fn_cddr },
+  { string62, NULL, 1, 1, fn_caaar },
+  { string63, NULL, 1, 1, fn_caadr },
+  { string64, NULL, 1, 1, fn_cadar },
+  { string65, NULL, 1, 1, fn_caddr },
+  { string66, NULL, 1, 1, fn_caddr },
+  { string67, NULL, 1, 1, fn_cdaar },
+  { string68, NULL, 1, 1, fn_cdadr },
+  { string69, NULL, 1, 1, fn_cddar },
+  { string70, NULL, 1, 1, fn_cdddr },
+  { string71, NULL, 1, 1, fn_length },
+  { string72, fn_list, 0, 127, NULL },
+  { string73, NULL, 1, 1, fn_reverse },
+  { string74, NULL, 2, 2, fn_nth },
+  { string75, NULL, 2, 2, fn_assoc },
+  { string76, NULL, 2, 2, fn_member },
+  { string77, fn_apply, 2, 127, NULL },
+  { string78, fn_funcall, 1, 127, NULL },
+  { string79, fn_append, 0, 127, NULL },
+  { string80, fn_mapc, 2, 127, NULL },
+  { string81, fn_mapcar, 2, 127, NULL },
+  { string82, fn_mapcan, 2, 127, NULL },
+  { string83, fn_add, 0, 127, fn_add2 },
+  { string84, fn_subtract, 1, 127, fn_subtract2 },
+  { string85, fn_multiply, 0, 127, fn_multiply2 },
+  { string86, fn_divide, 1, 127, NULL },
+  { string87, NULL, 2, 2, fn_mod },
+  { string88, NULL, 1, 1, fn_oneplus },
+  { string89, NULL, 1, 1, fn_oneminus },
+  { string90, NULL, 1, 1, fn_abs },
+  { string91, fn_random, 1, 1, NULL },
+  { string92, fn_maxfn, 1, 127, NULL },
+  { string93, fn_minfn, 1, 127, NULL },
+  { string94, fn_noteq, 1, 127, fn_noteq2 },
+  { string95, fn_numeq, 1, 127, fn_numeq2 },
+  { string96, fn_less, 1, 127, fn_less2 },
+  { string97, fn_lesseq, 1, 127, fn_lesseq2 },
+  { string98, fn_greater, 1, 127, fn_greater2 },
+  { string99, fn_greatereq, 1, 127, fn_greatereq2 },
+  { string100, NULL, 1, 1, fn_plusp },
+  { string101, NULL, 1, 1, fn_minusp },
+  { string102, NULL, 1, 1, fn_zerop },
+  { string103, NULL, 1, 1, fn_oddp },
+  { string104, NULL, 1, 1, fn_evenp },
+  { string105, NULL, 1, 1, fn_integerp },
+  { string106, NULL, 1, 1, fn_numberp },
+  { string107, fn_floatfn, 1, 1, NULL },
+  { string108, fn_floatp, 1, 1, NULL },
+  { string109, fn_sin, 1, 1, NULL },
+  { string110, fn_cos, 1, 1, NULL },
+  { string111, fn_tan, 1, 1, NULL },
+  { string112, fn_asin, 1, 1, NULL },
+  { string113, fn_acos, 1, 1, NULL },
+  { string114, fn_atan, 1, 2, NULL },
+  { string115, fn_sinh, 1, 1, NULL },
+  { string116, fn_cosh, 1, 1, NULL },
+  { string117, fn_tanh, 1, 1, NULL },
+  { string118, fn_exp, 1, 1, NULL },
+  { string119, fn_sqrt, 1, 1, NULL },
+  { string120, fn_log, 1, 2, NULL },
+  { string121, fn_expt, 2, 2, NULL },
+  { string122, fn_ceiling, 1, 2, NULL },
+  { string123, fn_floor, 1, 2, NULL },
+  { string124, fn_truncate, 1, 2, NULL },
+  { string125, fn_round, 1, 2, NULL },
+  { string126, fn_char, 2, 2, NULL },
+  { string127, fn_charcode, 1, 1, NULL },
+  { string128, fn_codechar, 1, 1, NULL },
+  { string129, fn_characterp, 1, 1, NULL },
+  { string130, fn_stringp, 1, 1, NULL },
+  { string131, fn_stringeq, 2, 2, NULL },
+  { string132, fn_stringless, 2, 2, NULL },
+  { string133, fn_stringgreater, 2, 2, NULL },
+  { string134, fn_sort, 2, 2, NULL },
+  { string135, fn_stringfn, 1, 1, NULL },
+  { string136, fn_concatenate, 1, 127, NULL },
+  { string137, fn_subseq, 2, 3, NULL },
+  { string138, fn_readfromstring, 1, 1, NULL },
+  { string139, fn_princtostring, 1, 1, NULL },
+  { string140, fn_prin1tostring, 1, 1, NULL },
+  { string141, fn_logand, 0, 127, NULL },
+  { string142, fn_logior, 0, 127, NULL },
+  { string143, fn_logxor, 0, 127, NULL },
+  { string144, fn_lognot, 1, 1, NULL },
+  { string145, fn_ash, 2, 2, NULL },
+  { string146, fn_logbitp, 2, 2, NULL },
+  { string147, fn_eval, 1, 1, NULL },
+  { string148, fn_globals, 0, 0, NULL },
+  { string149, fn_locals, 0, 0, NULL },
+  { string150, fn_makunbound, 1, 1, NULL },
+  { string151, fn_break, 0, 0, NULL },
+  { string152, fn_read, 0, 1, NULL },
+  { string153, fn_prin1, 1, 2, NULL },
+  { string154, fn_print, 1, 2, NULL },
+  { string155, fn_princ, 1, 2, NULL },
+  { string156, fn_terpri, 0, 1, NULL },
+  { string157, fn_readbyte, 0, 2, NULL },
+  { string158, fn_readline, 0, 1, NULL },
+  { string159, fn_writebyte, 1, 2, NULL },
+  { string160, fn_writestring, 1, 2, NULL },
+  { string161, fn_writeline, 1, 2, NULL },
+  { string162, fn_restarti2c, 1, 2, NULL },
+  { string163, fn_gc, 0, 0, NULL },
+  { string164, fn_room, 0, 0, NULL },
+  { string165, fn_saveimage, 0, 1, NULL },
+  { string166, fn_loadimage, 0, 1, NULL },
+  { string167, fn_cls, 0, 0, NULL },
+  { string168, fn_pinmode, 2, 2, NULL },
+  { string169, fn_digitalread, 1, 1, NULL },
+  { string170, fn_digitalwrite, 2, 2, NULL },
+  { string171, fn_analogread, 1, 1, NULL },
+  { string172, fn_analogwrite, 2, 2, NULL },
+  { string173, fn_delay, 1, 1, NULL },
+  { string174, fn_millis, 0, 0, NULL },
+  { string175, fn_sleep, 1, 1, NULL },
+  { string176, fn_note, 0, 3, NULL },
+  { string177, fn_edit, 1, 1, NULL },
+  { string178, fn_pprint, 1, 2, NULL },
+  { string179, fn_pprintall, 0, 0, NULL },
+  { string180, fn_require, 1, 1, NULL },
+  { string181, fn_listlibrary, 0, 0, NULL },
+  { string182, fn_available, 1, 1, NULL },
+  { string183, fn_wifiserver, 0, 0, NULL },
+  { string184, fn_wifisoftap, 0, 4, NULL },
+  { string185, fn_connected, 1, 1, NULL },
+  { string186, fn_wifilocalip, 0, 0, NULL },
+  { string187, fn_wificonnect, 0, 2, NULL },
+  { string188, fn_makearray, 1, 5, NULL },
+  { string189, NULL, 2, 2, fn_aref },
+  { string190, NULL, 1, 1, fn_vectorp },
+  { string191, fn_readsequence, 2, 6, NULL },
+  { string192, fn_writesequence, 2, 6, NULL },
+#define MODULEENTRY(name, lispname, fptr, fixed, min, max) { string##name, fptr, min, max, fixed },
+MODULEFUNCTIONS(MODULEENTRY)
 };
 
+static_assert(sizeof(lookup_table)/sizeof(lookup_table[0]) == ENDFUNCTIONS, "lookup_table doesn't match enum function");
+
 // Table lookup functions
 
+unsigned int namehash (const char *n) {
+  unsigned int h = 2166136261u;
+  while (*n) {
+    char c = *n++;
+    if (c >= 'A' && c <= 'Z') c = c | 0x20;
+    h = (h ^ c) * 16777619u;
+  }
+  return h;
+}
+
+// The builtins of the core and of each module, with the names kept under half the slots for short probes.
+// The index is filled at startup rather than at compile time, and takes 2 bytes of RAM per slot
+
+static_assert(ENDFUNCTIONS <= BUILTINHASHSIZE/2, "BUILTINHASHSIZE is too small for the builtins");
+
+void initbuiltins () {
+  for (int i=0; i<BUILTINHASHSIZE; i++) BuiltinHash[i] = ENDFUNCTIONS;
+  for (int entry=0; entry<ENDFUNCTIONS; entry++) {
+    unsigned int i = hashslot(namehash((char*)lookup_table[entry].string), BUILTINHASHSIZE);
+    while (BuiltinHash[i] != ENDFUNCTIONS) i = nextslot(i, BUILTINHASHSIZE);
+    BuiltinHash[i] = entry;
+  }
+}
+
 int builtin (char* n) {
-  int entry = 0;
-  while (entry < ENDFUNCTIONS) {
-    if (strcasecmp(n, (char*)lookup_table[entry].string) == 0)
-      return entry;
-    entry++;
+  unsigned int i = hashslot(namehash(n), BUILTINHASHSIZE);
+  while (BuiltinHash[i] != ENDFUNCTIONS) {
+    int entry = BuiltinHash[i];
+    if (strcasecmp(n, (char*)lookup_table[entry].string) == 0) return entry;
+    i = nextslot(i, BUILTINHASHSIZE);
   }
   return ENDFUNCTIONS;
 }
 
+// Long symbols - ids are stable, so a deleted name leaves an empty entry
+
+void growstack (unsigned int slots) {
+  if (slots <= StackSize) return;
+  unsigned int size = (StackSize == 0) ? STACKSIZE : StackSize;
+  while (slots > size) size = size * 2;
+  object **stack = (size > 65536) ? NULL : (object **)realloc(Stack, size * sizeof(object *));
+  if (stack == NULL) error2(0, PSTR("Stack overflow"));
+  Stack = stack; StackSize = size;
+}
+
+void growframes () {
+  if (FrameSize >= MAXDEPTH) error2(0, PSTR("Stack overflow"));
+  unsigned int size = (FrameSize == 0) ? 32 : FrameSize * 2;
+  if (size > MAXDEPTH) size = MAXDEPTH;
+  frame_t *frames = (frame_t *)realloc(Frames, size * sizeof(frame_t));
+  if (frames == NULL) error2(0, PSTR("Stack overflow"));
+  Frames = frames; FrameSize = size;
+}
+
+// A deleted name keeps its length, so that indexsymbols still gives every later name the same id
+
+#define DELETEDNAME '\x7f'
+
+inline boolean deletedname (unsigned int offset) {
+  return SymbolTable[offset] == DELETEDNAME;
+}
+
+void growsymbols (unsigned int bytes) {
+  if (SymbolTop + bytes <= SymbolTableSize) return;
+  unsigned int size = (SymbolTableSize == 0) ? SYMBOLTABLESIZE : SymbolTableSize;
+  while (SymbolTop + bytes > size) size = size * 2;
+  if (size > 65536) error2(0, PSTR("no room for long symbols"));
+  char *table = (char *)realloc(SymbolTable, size);
+  if (table == NULL) error2(0, PSTR("no room for long symbols"));
+  SymbolTable = table; SymbolTableSize = size;
+}
+
+void hashsymbol (unsigned int id) {
+  unsigned int i = hashslot(namehash(&SymbolTable[SymbolOffset[id]]), SymbolHashSize);
+  while (SymbolHash[i] != 0) i = nextslot(i, SymbolHashSize);
+  SymbolHash[i] = id + 1;
+}
+
+void addsymbolid (unsigned int offset) {
+  if (SymbolCount >= 65535) error2(0, PSTR("too many long symbols"));
+  if (SymbolCount == SymbolMax) {
+    unsigned int max = (SymbolMax == 0) ? 64 : SymbolMax * 2;
+    uint16_t *ids = (uint16_t *)realloc(SymbolOffset, max * sizeof(uint16_t));
+    if (ids == NULL) error2(0, PSTR("no room for long symbols"));
+    SymbolOffset = ids; SymbolMax = max;
+  }
+  SymbolOffset[SymbolCount] = offset;
+  if (tablefull(SymbolCount, SymbolHashSize)) {
+    unsigned int size = tablesize(SymbolCount, 128);
+    SymbolHash = (uint16_t *)cleartable(SymbolHash, size, sizeof(uint16_t), PSTR("no room for long symbols"));
+    SymbolHashSize = size;
+    for (unsigned int id=0; id<SymbolCount; id++) if (!deletedname(SymbolOffset[id])) hashsymbol(id);
+  }
+  if (!deletedname(offset)) hashsymbol(SymbolCount);
+  SymbolCount++;
+}
+
+void indexsymbols () {
+  SymbolCount = 0;
+  for (unsigned int i=0; i<SymbolHashSize; i++) SymbolHash[i] = 0;
+  unsigned int offset = 0;
+  while (offset < SymbolTop) {
+    addsymbolid(offset);
+    offset = offset + strlen(&SymbolTable[offset]) + 1;
+  }
+}
+
+void initsymbols () {
+  SymbolTop = 0;
+  growsymbols(SYMBOLTABLESIZE);
+  indexsymbols();
+}
+
 int longsymbol (char *buffer) {
-  char *p = SymbolTable;
-  int i = 0;
-  while (strcasecmp(p, buffer) != 0) {p = p + strlen(p) + 1; i++; }
-  if (p == buffer) {
-    // Add to symbol table?
-    char *newtop = SymbolTop + strlen(p) + 1;
-    if (SYMBOLTABLESIZE - (newtop - SymbolTable) < BUFFERSIZE) error2(0, PSTR("no room for long symbols"));
-    SymbolTop = newtop;
+  if (SymbolHashSize != 0) {
+    unsigned int i = hashslot(namehash(buffer), SymbolHashSize);
+    while (SymbolHash[i] != 0) {
+      unsigned int id = SymbolHash[i] - 1;
+      if (strcasecmp(&SymbolTable[SymbolOffset[id]], buffer) == 0) return id + 64000; // Builtins are below 64000, packed names above PACKED40
+      i = nextslot(i, SymbolHashSize);
+    }
   }
-  if (i > 1535) error2(0, PSTR("Too many long symbols"));
-  return i + 64000; // First number unused by radix40
+  // Add to symbol table
+  unsigned int len = strlen(buffer) + 1;
+  growsymbols(len);
+  strcpy(&SymbolTable[SymbolTop], buffer);
+  addsymbolid(SymbolTop);
+  SymbolTop = SymbolTop + len;
+  return SymbolCount - 1 + 64000;
 }
 
 intptr_t lookupfn (symbol_t name) {
   return (intptr_t)lookup_table[name].fptr;
 }
 
+fn_fixed_type lookupfixed (symbol_t name) {
+  return lookup_table[name].fixed;
+}
+
 uint8_t lookupmin (symbol_t name) {
   return lookup_table[name].min;
 }
@@ -3919,26 +6299,54 @@ uint8_t lookupmax (symbol_t name) {
   return lookup_table[name].max;
 }
 
+// Returns the fixed-arity entry point of function if it's a builtin taking nargs arguments, or NULL
+fn_fixed_type fixedfn (object *function, int nargs) {
+  if (!symbolp(function)) return NULL;
+  symbol_t name = function->name;
+  if (name >= ENDFUNCTIONS) return NULL;
+  uint8_t min = lookupmin(name);
+  if (nargs != ((min == lookupmax(name)) ? min : 2)) return NULL;
+  return lookupfixed(name);
+}
+
+// Calls a builtin function with its arguments in a list, which have already been checked
+object *callfn (symbol_t name, object *args, object *env) {
+  fn_ptr_type fn = (fn_ptr_type)lookupfn(name);
+  if (fn != NULL) return fn(args, env);
+  fn_fixed_type fixed = lookupfixed(name);
+  object *array[3];
+  for (int i=0; args != NULL; i++) { array[i] = car(args); args = cdr(args); }
+  return fixed(array, env);
+}
+
 char *lookupbuiltin (symbol_t name) {
-  char *buffer = SymbolTop;
+  char *buffer = Scratch;
   strcpy(buffer, (char *)lookup_table[name].string);
   return buffer;
 }
 
 char *lookupsymbol (symbol_t name) {
-  char *p = SymbolTable;
-  int i = name - 64000;
-  while (i > 0 && p < SymbolTop) {p = p + strlen(p) + 1; i--; }
-  if (p == SymbolTop) return NULL; else return p;
+  unsigned int id = name - 64000;
+  if (id >= SymbolCount) return NULL;
+  return &SymbolTable[SymbolOffset[id]];
 }
 
 void deletesymbol (symbol_t name) {
   char *p = lookupsymbol(name);
-  if (p == NULL) return;
-  char *q = p + strlen(p) + 1;
-  *p = '\0'; p++;
-  while (q < SymbolTop) *(p++) = *(q++);
-  SymbolTop = p;
+  if (p == NULL || *p == DELETEDNAME) return;
+  unsigned int id = name - 64000;
+  unsigned int i = hashslot(namehash(p), SymbolHashSize);
+  while (SymbolHash[i] != id + 1) i = nextslot(i, SymbolHashSize);
+  // Re-insert the rest of the cluster so later probes still find their names
+  SymbolHash[i] = 0;
+  memset(p, DELETEDNAME, strlen(p));
+  i = nextslot(i, SymbolHashSize);
+  while (SymbolHash[i] != 0) {
+    unsigned int other = SymbolHash[i] - 1;
+    SymbolHash[i] = 0;
+    hashsymbol(other);
+    i = nextslot(i, SymbolHashSize);
+  }
 }
 
 void testescape () {
@@ -3949,32 +6357,53 @@ void testescape () {
 
 uint8_t End;
 
-object *eval (object *form, object *env) {
-  int TC=0;
-  EVAL:
+// Called before each evaluation step; form and env are all that is live apart from GCStack
+
+// Yields and checks for the escape key once ESCAPELATENCY microseconds have passed; the time is read
+// every POLLEVALS safepoints, so however slow each eval is, the gap only overshoots by that many evals
+
+void pollescape () {
+  PollCount = POLLEVALS;
+  unsigned long now = micros(), elapsed = now - PollTime;
+  if (elapsed < ESCAPELATENCY) return;
+  PollTime = now;
+  if (elapsed > PollWorst) PollWorst = elapsed;
   yield(); // Needed on ESP8266 to avoid Soft WDT Reset
+  #if defined (serialmonitor)
+  if (!tstflag(NOESC)) testescape();
+  #endif
+}
+
+void safepoint (object *form, object *env) {
   // Enough space?
   if (End != 0xA5) error2(0, PSTR("Stack overflow"));
-  if (Freespace <= WORKSPACESIZE>>4) gc(form, env);
+  GCEvals++;
+  if (Freespace <= GCThreshold && !tstflag(NOGC)) gc(form, env);
   // Escape
   if (tstflag(ESCAPE)) { clrflag(ESCAPE); error2(0, PSTR("Escape!"));}
-  #if defined (serialmonitor)
-  if (!tstflag(NOESC)) testescape();
-  #endif
+  if (--PollCount == 0) pollescape();
+}
+
+object *eval (object *form, object *env) {
+  int TC=0;
+  EVAL:
+  safepoint(form, env);
   
   if (form == NULL) return nil;
 
-  if (integerp(form) || floatp(form) || characterp(form) || stringp(form)) return form;
-
-  if (symbolp(form)) {
-    symbol_t name = form->name;
-    if (name == NIL) return nil;
-    object *pair = value(name, env);
-    if (pair != NULL) return cdr(pair);
-    pair = value(name, GlobalEnv);
-    if (pair != NULL) return cdr(pair);
-    else if (name <= ENDFUNCTIONS) return form;
-    error(0, PSTR("undefined"), form);
+  switch (form->type) {
+    case NUMBER: case FLOAT: case CHARACTER: case STRING: case LONGSTRING: case VECTOR:
+      return form;
+    case SYMBOL: {
+      symbol_t name = form->name;
+      if (name == NIL) return nil;
+      object *pair = value(name, env);
+      if (pair != NULL) return cdr(pair);
+      pair = globalvalue(name);
+      if (pair != NULL) return cdr(pair);
+      else if (name <= ENDFUNCTIONS || keywordp(form)) return form;
+      error(0, PSTR("undefined"), form);
+    }
   }
   
   // It's a list
@@ -3982,13 +6411,46 @@ object *eval (object *form, object *env) {
   object *args = cdr(form);
 
   if (function == NULL) error(0, PSTR("illegal function"), nil);
+  switch (function->type) {
+    case LOCAL: return cdr(local(form, env));
+    case CALLSITE: return callsite(form, env);
+    case TYPED: return typedform(form, env);
+  }
   if (!listp(args)) error(0, PSTR("can't evaluate a dotted pair"), args);
 
-  // List starts with a symbol?
-  if (symbolp(function)) {
+  // Analysed lambda
+  if (codep(function)) return makeclosure(form, env);
+
+  // List starts with a symbol before FUNCTIONS?
+  if (symbolp(function) && function->name < FUNCTIONS) {
     symbol_t name = function->name;
 
-    if ((name == LET) || (name == LETSTAR)) {
+    #if defined(__GNUC__)
+    // Jump straight to the handler for each name
+    static const void *const FormTable[] = {
+      &&NOTAFUNCTION, &&NOTAFUNCTION, &&NOTAFUNCTION, &&NOTAFUNCTION, &&NOTAFUNCTION, // NIL to AMPREST
+      &&LAMBDAFORM, &&LETFORM, &&LETFORM, &&NOTAFUNCTION, &&NOTAFUNCTION, // LAMBDA to MACRO
+      &&CALL, // SPECIAL_FORMS
+      &&SPECIALFORM, &&SPECIALFORM, &&SPECIALFORM, &&SPECIALFORM, &&SPECIALFORM, &&SPECIALFORM, // QUOTE to LOOP
+      &&SPECIALFORM, &&SPECIALFORM, &&SPECIALFORM, &&SPECIALFORM, &&SPECIALFORM, &&SPECIALFORM, // RETURN to SETF
+      &&SPECIALFORM, &&SPECIALFORM, &&SPECIALFORM, &&SPECIALFORM, &&SPECIALFORM, &&SPECIALFORM, // DOLIST to WITHSERIAL
+      &&SPECIALFORM, &&SPECIALFORM, &&SPECIALFORM, &&SPECIALFORM, &&SPECIALFORM, &&SPECIALFORM, // WITHI2C to DECLARE
+      &&CALL, // TAIL_FORMS
+      &&TAILFORM, &&TAILFORM, &&TAILFORM, &&TAILFORM, &&TAILFORM, &&TAILFORM, &&TAILFORM, &&TAILFORM // PROGN to OR
+    };
+    static_assert(LAMBDA == 5 && SPECIAL_FORMS == 10 && TAIL_FORMS == 35 && sizeof(FormTable)/sizeof(FormTable[0]) == FUNCTIONS,
+      "FormTable doesn't match enum function");
+    goto *FormTable[name];
+    #else
+    if ((name == LET) || (name == LETSTAR)) goto LETFORM;
+    if (name == LAMBDA) goto LAMBDAFORM;
+    if (name < SPECIAL_FORMS) goto NOTAFUNCTION;
+    if ((name > SPECIAL_FORMS) && (name < TAIL_FORMS)) goto SPECIALFORM;
+    if (name > TAIL_FORMS) goto TAILFORM;
+    goto CALL;
+    #endif
+
+    LETFORM: {
       int TCstart = TC;
       object *assigns = first(args);
       object *forms = cdr(args);
@@ -3996,9 +6458,9 @@ object *eval (object *form, object *env) {
       push(newenv, GCStack);
       while (assigns != NULL) {
         object *assign = car(assigns);
-        if (!consp(assign)) push(cons(assign,nil), newenv);
-        else if (cdr(assign) == NULL) push(cons(first(assign),nil), newenv);
-        else push(cons(first(assign),eval(second(assign),env)), newenv);
+        if (!consp(assign)) push(localbinding(assign, nil), newenv);
+        else if (cdr(assign) == NULL) push(localbinding(first(assign), nil), newenv);
+        else push(localbinding(first(assign), eval(second(assign),env)), newenv);
         car(GCStack) = newenv;
         if (name == LETSTAR) env = newenv;
         assigns = cdr(assigns);
@@ -4010,39 +6472,61 @@ object *eval (object *form, object *env) {
       goto EVAL;
     }
 
-    if (name == LAMBDA) {
-      if (env == NULL) return form;
-      object *envcopy = NULL;
-      while (env != NULL) {
-        object *pair = first(env);
-        if (pair != NULL) push(pair, envcopy);
-        env = cdr(env);
-      }
-      return cons(symbol(CLOSURE), cons(envcopy,args));
-    }
-    
-    if (name < SPECIAL_FORMS) error2((int)function, PSTR("can't be used as a function"));
+    LAMBDAFORM:
+    return makeclosure(form, env);
 
-    if ((name > SPECIAL_FORMS) && (name < TAIL_FORMS)) {
-      return ((fn_ptr_type)lookupfn(name))(args, env);
-    }
+    NOTAFUNCTION:
+    error2((int)function, PSTR("can't be used as a function"));
 
-    if ((name > TAIL_FORMS) && (name < FUNCTIONS)) {
-      form = ((fn_ptr_type)lookupfn(name))(args, env);
-      TC = 1;
-      goto EVAL;
-    }
+    SPECIALFORM:
+    return ((fn_ptr_type)lookupfn(name))(args, env);
+
+    TAILFORM:
+    form = ((fn_ptr_type)lookupfn(name))(args, env);
+    TC = 1;
+    goto EVAL;
   }
-        
-  // Evaluate the parameters - result in head
+
+  CALL:
   object *fname = car(form);
   int TCstart = TC;
-  object *head = cons(eval(car(form), env), NULL);
-  push(head, GCStack); // Don't GC the result list
-  object *tail = head;
+  if (callsitep(fname)) {
+    function = callsite(fname, env);
+    fname = second(fname);
+  } else function = eval(fname, env);
+  symbol_t name = symbolp(fname) ? fname->name : 0;
+
+  // Macro call that wasn't expanded by the analysis - evaluate its expansion, leaving the form alone
+  if (macrop(function)) {
+    form = apply(name, cdr(function), cdr(form), env);
+    goto EVAL;
+  }
+
   form = cdr(form);
   int nargs = 0;
 
+  // Builtin with a fixed-arity entry point - evaluate the parameters onto the stack
+  for (object *f = form; f != NULL; f = cdr(f)) nargs++;
+  fn_fixed_type fixed = fixedfn(function, nargs);
+  if (fixed != NULL) {
+    unsigned int base = StackTop;
+    growstack(base + nargs);
+    while (form != NULL) {
+      object *arg = eval(car(form), env);
+      Stack[StackTop++] = arg;
+      form = cdr(form);
+    }
+    object *result = fixed(&Stack[base], env);
+    StackTop = base;
+    return result;
+  }
+
+  // Evaluate the parameters - result in head
+  object *head = cons(function, NULL);
+  push(head, GCStack); // Don't GC the result list
+  object *tail = head;
+  nargs = 0;
+
   while (form != NULL){
     object *obj = cons(eval(car(form),env),NULL);
     cdr(tail) = obj;
@@ -4059,22 +6543,24 @@ object *eval (object *form, object *env) {
     if (name >= ENDFUNCTIONS) error(0, PSTR("not valid here"), fname);
     if (nargs<lookupmin(name)) error2(name, PSTR("has too few arguments"));
     if (nargs>lookupmax(name)) error2(name, PSTR("has too many arguments"));
-    object *result = ((fn_ptr_type)lookupfn(name))(args, env);
+    object *result = callfn(name, args, env);
     pop(GCStack);
     return result;
   }
       
-  if (consp(function) && issymbol(car(function), LAMBDA)) {
-    form = closure(TCstart, fname->name, NULL, cdr(function), args, &env);
+  if (lambdap(function)) {
+    #if defined(compiler)
+    if (compiled(function) != NULL) {
+      pop(GCStack);
+      return vmrun(name, function, NULL, args, env);
+    }
+    #endif
+    form = closure(TCstart, name, NULL, function, args, &env);
     pop(GCStack);
-    int trace = tracing(fname->name);
+    int trace = name ? tracing(name) : 0;
     if (trace) {
       object *result = eval(form, env);
-      indent((--(TraceDepth[trace-1]))<<1, pserial);
-      pint(TraceDepth[trace-1], pserial);
-      pserial(':'); pserial(' ');
-      printobject(fname, pserial); pfstring(PSTR(" returned "), pserial);
-      printobject(result, pserial); pln(pserial);
+      tracereturn(trace, name, result);
       return result;
     } else {
       TC = 1;
@@ -4084,7 +6570,13 @@ object *eval (object *form, object *env) {
 
   if (consp(function) && issymbol(car(function), CLOSURE)) {
     function = cdr(function);
-    form = closure(TCstart, fname->name, car(function), cdr(function), args, &env);
+    #if defined(compiler)
+    if (compiled(cdr(function)) != NULL) {
+      pop(GCStack);
+      return vmrun(name, cdr(function), car(function), args, env);
+    }
+    #endif
+    form = closure(TCstart, name, car(function), cdr(function), args, &env);
     pop(GCStack);
     TC = 1;
     goto EVAL;
@@ -4095,10 +6587,6 @@ object *eval (object *form, object *env) {
 
 // Print functions
 
-inline int maxbuffer (char *buffer) {
-  return SYMBOLTABLESIZE-(buffer-SymbolTable)-1;
-}
-
 void pserial (char c) {
   LastPrint = c;
   if (c == '\n') Serial.write('\r');
@@ -4127,7 +6615,16 @@ void pstring (char *s, pfun_t pfun) {
 
 void printstring (object *form, pfun_t pfun) {
   if (tstflag(PRINTREADABLY)) pfun('"');
-  form = cdr(form);
+  if (form->type == LONGSTRING) {
+    char *chars = stringchars(form);
+    int length = stringlength(form);
+    for (int i=0; i<length; i++) {
+      char ch = chars[i];
+      if (tstflag(PRINTREADABLY) && (ch == '"' || ch == '\\')) pfun('\\');
+      pfun(ch);
+    }
+    form = NULL;
+  } else form = cdr(form);
   while (form != NULL) {
     int chars = form->integer;
     for (int i=(sizeof(int)-1)*8; i>=0; i=i-8) {
@@ -4223,6 +6720,9 @@ void pfl (pfun_t pfun) {
 void printobject (object *form, pfun_t pfun){
   if (form == NULL) pfstring(PSTR("nil"), pfun);
   else if (listp(form) && issymbol(car(form), CLOSURE)) pfstring(PSTR("<closure>"), pfun);
+  else if (localp(form)) printobject(cdr(form), pfun);
+  else if (callsitep(form)) printobject(second(form), pfun);
+  else if (typedp(form)) printobject(cdr(form), pfun);
   else if (listp(form)) {
     pfun('(');
     printobject(car(form), pfun);
@@ -4242,6 +6742,15 @@ void printobject (object *form, pfun_t pfun){
   else if (symbolp(form)) { if (form->name != NOTHING) pstring(symbolname(form->name), pfun); }
   else if (characterp(form)) pcharacter(form->integer, pfun);
   else if (stringp(form)) printstring(form, pfun);
+  else if (vectorp(form)) {
+    pfun('#'); pfun('(');
+    int length = vectorlength(form);
+    for (int i=0; i<length; i++) {
+      if (i) pfun(' ');
+      printobject(vectorref(form, i), pfun);
+    }
+    pfun(')');
+  } else if (codep(form)) pfstring(PSTR("lambda"), pfun);
   else if (streamp(form)) {
     pfstring(PSTR("<"), pfun);
     if ((form->integer)>>8 == SPISTREAM) pfstring(PSTR("spi"), pfun);
@@ -4307,8 +6816,8 @@ object *nextitem (gfun_t gfun) {
   
   // Parse symbol, character, or number
   int index = 0, base = 10, sign = 1;
-  char *buffer = SymbolTop;
-  int bufmax = maxbuffer(buffer); // Max index
+  char *buffer = Scratch;
+  int bufmax = SCRATCHSIZE-1; // Max index
   unsigned int result = 0;
   boolean isfloat = false;
   float fresult = 0.0;
@@ -4333,6 +6842,7 @@ object *nextitem (gfun_t gfun) {
     else if (ch2 == 'O') base = 8;
     else if (ch2 == 'X') base = 16;
     else if (ch == '\'') return nextitem(gfun);
+    else if (ch == '(') return listvector(readrest(gfun));
     else if (ch == '.') {
       setflag(NOESC);
       object *result = eval(read(gfun), NULL);
@@ -4345,7 +6855,6 @@ object *nextitem (gfun_t gfun) {
   if (ch == '.') valid = 0; else if (digitvalue(ch)<base) valid = 1; else valid = -1;
   boolean isexponent = false;
   int exponent = 0, esign = 1;
-  buffer[2] = '\0'; // In case symbol is one letter
   float divisor = 10.0;
   
   while(!isspace(ch) && ch != ')' && ch != '(' && index < bufmax) {
@@ -4394,9 +6903,9 @@ object *nextitem (gfun_t gfun) {
   
   int x = builtin(buffer);
   if (x == NIL) return nil;
-  if (x < ENDFUNCTIONS) return newsymbol(x);
-  else if (index < 4 && valid40(buffer)) return newsymbol(pack40(buffer));
-  else return newsymbol(longsymbol(buffer));
+  if (x < ENDFUNCTIONS) return symbol(x);
+  else if (index <= 6 && valid40(buffer)) return symbol(pack40(buffer));
+  else return symbol(longsymbol(buffer));
 }
 
 object *readrest (gfun_t gfun) {
@@ -4433,10 +6942,256 @@ object *read (gfun_t gfun) {
   return item;
 }
 
+// Benchmarks
+
+#if defined(benchmarks)
+void benchreader () {
+  const int passes = 20;
+  int tokens = 0;
+  unsigned long start = micros();
+  for (int p=0; p<passes; p++) {
+    GlobalStringIndex = 0;
+    while (nextitem(glibrary) != nil || LispLibrary[GlobalStringIndex-1] != 0) tokens++;
+    gc(NULL, NULL);
+  }
+  unsigned long elapsed = micros() - start;
+  pfl(pserial); pfstring(PSTR("Reader: "), pserial);
+  pint((int)((unsigned long long)tokens * 1000000 / elapsed), pserial);
+  pfstring(PSTR(" tokens/s"), pserial); pln(pserial);
+}
+
+// Time per node evaluated, with a mix of special forms, tail forms, constants, and symbols
+
+object *dispatchform () {
+  object *form = NULL;
+  for (int i=0; i<20; i++) {
+    push(cons(symbol(IF), cons(tee, cons(number(i), cons(character('a'), NULL)))), form);
+    push(cons(symbol(QUOTE), cons(symbol(NOTHING), NULL)), form);
+  }
+  return cons(symbol(PROGN), form);
+}
+
+void benchdispatch () {
+  const int passes = 1000;
+  object *form = dispatchform();
+  push(form, GCStack);
+  End = 0xA5; // Normally set by loop()
+  setflag(NOGC); // So GCEvals counts every node
+  GCEvals = 0;
+  unsigned long start = micros();
+  for (int p=0; p<passes; p++) eval(form, NULL);
+  unsigned long elapsed = micros() - start;
+  unsigned int nodes = GCEvals;
+  clrflag(NOGC);
+  pop(GCStack);
+  pfl(pserial); pfstring(PSTR("Dispatch: "), pserial);
+  pint((int)((unsigned long long)elapsed * 1000 / nodes), pserial);
+  pfstring(PSTR(" ns/node"), pserial); pln(pserial);
+}
+
+// Longest time between polls for the escape key while evaluating for a second
+
+void benchpoll () {
+  object *form = dispatchform();
+  push(form, GCStack);
+  End = 0xA5; // Normally set by loop()
+  PollWorst = 0; PollTime = micros();
+  unsigned long start = millis();
+  while (millis() - start < 1000) eval(form, NULL);
+  pop(GCStack);
+  pfl(pserial); pfstring(PSTR("Escape latency: "), pserial);
+  pint(PollWorst, pserial); pfstring(PSTR(" us"), pserial); pln(pserial);
+}
+
+void runbenchmarks () {
+  benchreader();
+  benchdispatch();
+  benchpoll();
+}
+#endif
+
+#if defined(selftests)
+// Self-tests, run at startup, of behaviour the REPL can't check for itself
+
+const char *TestText;
+
+int gtest () {
+  if (LastChar) { 
+    char temp = LastChar;
+    LastChar = 0;
+    return temp;
+  }
+  char c = TestText[GlobalStringIndex];
+  if (c == 0) return -1; // Stays at the end
+  GlobalStringIndex++;
+  return c;
+}
+
+object *readtext (const char *text) {
+  TestText = text;
+  GlobalStringIndex = 0;
+  object *head = cons(NULL, NULL), *tail = head;
+  object *form = read(gtest);
+  while (form != NULL) {
+    cdr(tail) = cons(form, NULL);
+    tail = cdr(tail);
+    form = read(gtest);
+  }
+  return cdr(head);
+}
+
+int TestsPassed = 0, TestsFailed = 0;
+
+void selftest (PGM_P what, boolean ok) {
+  if (ok) { TestsPassed++; return; }
+  TestsFailed++;
+  pfl(pserial); pfstring(PSTR("Self-test failed: "), pserial); pfstring(what, pserial); pln(pserial);
+}
+
+// Binding a name locally stops call sites to it being cached, but must leave other names alone,
+// including one that shared a slot with it when the local names were kept in a 256-bit bitmap
+
+void checklocalnames () {
+  object *forms = readtext(PSTR("(defun stcall () 42)"));
+  push(forms, GCStack);
+  eval(first(forms), NULL);
+  object *callee = second(first(forms));
+  notelocal(symbol(callee->name ^ 0x101));
+  object *site = analysecall(callee, NULL);
+  push(site, GCStack);
+  object *function = callsite(site, NULL);
+  selftest(PSTR("call site with a colliding local name"), car(site)->integer == (int)GlobalEpoch && function == globalvalue(callee->name)->cdr);
+  notelocal(callee);
+  car(site)->integer = 0;
+  callsite(site, NULL);
+  selftest(PSTR("call site with the same local name"), car(site)->integer != (int)GlobalEpoch);
+  fn_makunbound(cons(callee, NULL), NULL);
+  pop(GCStack); pop(GCStack);
+}
+
+// Returns the printed value of form, or NULL if it gives an error
+
+object *checkresult (object *form) {
+  object *roots = GCStack, *result;
+  jmp_buf saved;
+  memcpy(saved, exception, sizeof(jmp_buf));
+  if (setjmp(exception)) result = NULL;
+  else result = fn_prin1tostring(cons(eval(form, NULL), NULL), NULL);
+  memcpy(exception, saved, sizeof(jmp_buf));
+  GCStack = roots; // Cleared by an error
+  return result;
+}
+
+#if defined(compiler)
+// Calls from compiled code to compiled functions, directly or through funcall or apply, nest without
+// C recursion, so they can go deeper than the C stack allows, and past MAXDEPTH give an error
+
+void checkdeepcalls () {
+  object *forms = readtext(PSTR("(defun stdeep (n) (if (= n 0) 0 (+ 1 (stdeep (- n 1)))))"
+    "(defun stfuncall (n) (if (= n 0) 0 (+ 1 (funcall stfuncall (- n 1)))))"
+    "(defun stapply (n) (if (= n 0) 0 (+ 1 (apply stapply (list (- n 1))))))"));
+  push(forms, GCStack);
+  // The calls are made up front, as an error can leave the workspace full until the next collection
+  object *calls = NULL;
+  for (object *f = forms; f != NULL; f = cdr(f)) {
+    checkresult(car(f));
+    object *name = second(car(f));
+    push(cons(name, cons(number(MAXDEPTH + 1), NULL)), calls);
+    push(cons(name, cons(number(400), NULL)), calls);
+  }
+  push(calls, GCStack);
+  PGM_P what[] = { PSTR("deep calls through apply"), PSTR("deep calls through funcall"), PSTR("deep direct calls") };
+  for (int i=0; i<3; i++) {
+    object *result = checkresult(first(calls));
+    selftest(what[i], result != NULL && stringlength(result) == 3 && nthchar(result, 0) == '4');
+    selftest(PSTR("calls deeper than MAXDEPTH"), checkresult(second(calls)) == NULL);
+    calls = cddr(calls);
+  }
+  gc(NULL, NULL);
+  for (object *f = forms; f != NULL; f = cdr(f)) fn_makunbound(cons(second(car(f)), NULL), NULL);
+  pop(GCStack); pop(GCStack);
+}
+#endif
+
+void printresult (object *result) {
+  if (result == NULL) pfstring(PSTR("an error"), pserial);
+  else printstring(result, pserial);
+}
+
+#if defined(nativefunctions)
+// Checks the native functions against the interpreter: each expression in NativeCorpus is evaluated with
+// them, and again with their Lisp definitions from NativeSource in their place
+
+void checknatives () {
+  object *corpus = readtext(NativeCorpus);
+  push(corpus, GCStack);
+  object *head = cons(NULL, NULL), *tail = head;
+  push(head, GCStack);
+  for (object *f = corpus; f != NULL; f = cdr(f)) {
+    object *result = checkresult(car(f));
+    cdr(tail) = cons(result, NULL);
+    tail = cdr(tail);
+  }
+  // Definitions take precedence over builtins with the same name
+  object *source = readtext(NativeSource);
+  push(source, GCStack);
+  for (object *d = source; d != NULL; d = cdr(d)) checkresult(car(d));
+  int passed = 0, failed = 0;
+  object *natives = cdr(head);
+  for (object *f = corpus; f != NULL; f = cdr(f)) {
+    object *native = car(natives), *interpreted = checkresult(car(f));
+    if ((native == NULL || interpreted == NULL) ? native == interpreted :
+      stringcompare(STRINGEQ, cons(native, cons(interpreted, NULL)), false, false, true)) passed++;
+    else {
+      failed++;
+      pfl(pserial); pfstring(PSTR("Native "), pserial); printobject(car(f), pserial);
+      pfstring(PSTR(" gives "), pserial); printresult(native);
+      pfstring(PSTR(", interpreted "), pserial); printresult(interpreted); pln(pserial);
+    }
+    natives = cdr(natives);
+  }
+  for (object *d = source; d != NULL; d = cdr(d)) fn_makunbound(cons(second(car(d)), NULL), NULL);
+  pop(GCStack); pop(GCStack); pop(GCStack);
+  pfl(pserial); pfstring(PSTR("Native functions: "), pserial);
+  pint(passed, pserial); pfstring(PSTR(" passed, "), pserial);
+  pint(failed, pserial); pfstring(PSTR(" failed"), pserial); pln(pserial);
+}
+#endif
+
+void runselftests () {
+  End = 0xA5; // Normally set by loop()
+  checklocalnames();
+  #if defined(compiler)
+  checkdeepcalls();
+  #endif
+  pfl(pserial); pfstring(PSTR("Self-tests: "), pserial);
+  pint(TestsPassed, pserial); pfstring(PSTR(" passed, "), pserial);
+  pint(TestsFailed, pserial); pfstring(PSTR(" failed"), pserial); pln(pserial);
+  #if defined(nativefunctions)
+  checknatives();
+  #endif
+}
+#endif
+
 // Setup
 
 void initenv () {
   GlobalEnv = NULL;
+  indexglobals();
+  for (int i=0; i<ENDFUNCTIONS; i++) {
+    Builtins[i].type = SYMBOL;
+    Builtins[i].name = i;
+  }
+  for (int i=0; i<MAXHOPS; i++) {
+    LocalTags[i].type = LOCAL;
+    LocalTags[i].integer = i;
+  }
+  for (int i=0; i<4; i++) {
+    TypedTags[i].type = TYPED;
+    TypedTags[i].integer = i;
+  }
+  initbuiltins();
+  initsymbols();
   tee = symbol(TEE);
 }
 
@@ -4448,6 +7203,12 @@ void setup () {
   initenv();
   initsleep();
   pfstring(PSTR("uLisp 3.0 "), pserial); pln(pserial);
+  #if defined(benchmarks)
+  runbenchmarks();
+  #endif
+  #if defined(selftests)
+  runselftests();
+  #endif
 }
 
 // Read/Evaluate/Print loop
@@ -4455,7 +7216,8 @@ void setup () {
 void repl (object *env) {
   for (;;) {
     randomSeed(micros());
-    gc(NULL, env);
+    // Only collect once half of the space freed last time has been used
+    if (Freespace <= GCFree>>1) gc(NULL, env);
     #if defined (printfreespace)
     pint(Freespace, pserial);
     #endif
@@ -4469,6 +7231,7 @@ void repl (object *env) {
     if (line == (object *)KET) error2(0, PSTR("unmatched right bracket"));
     push(line, GCStack);
     pfl(pserial);
+    PollTime = micros(); // Don't count the time spent waiting for input
     line = eval(line, env);
     pfl(pserial);
     printobject(line, pserial);
@@ -0,0 +1,641 @@
+#!/usr/bin/env python3
+"""Translates uLisp defuns into C builtins for src/ulisp-esp.cpp.
+
+Usage: lisp2c.py [-o include/NativeFunctions.h] [--corpus tests.lisp] functions.lisp
+
+Each defun becomes a C function in a builtin module, as described in include/Modules.h; build with
+nativefunctions defined to link them in. With a corpus of test expressions, and selftests also
+defined, the firmware evaluates each one at startup with the native functions and again with the
+original definitions, and reports any result that differs.
+
+The translated subset:
+  - defun with required parameters, an optional documentation string, and declarations, which
+    are ignored;
+  - integers, floats, characters, nil, t, and the parameters and local variables;
+  - if, when, unless, cond, and, or, not, null, progn, let, let*, setq, incf, decf, dotimes,
+    dolist, loop, and return from the innermost loop;
+  - calls to the other functions being translated, and to builtin functions that don't evaluate
+    Lisp code; + - * and the numeric comparisons on two arguments test for fixnums inline.
+
+Lisp values stay boxed, so overflow, floats, and errors behave as in the interpreter; float
+literals are rounded by the C compiler, which may differ from the reader in the last place.
+Functions that loop or call other native functions keep their variables in a frame of stack
+slots and call safepoint() on entry and in each loop, so that they can be escaped and the
+garbage collector can run.
+"""
+
+import argparse
+import os
+import re
+import sys
+
+# Reader
+
+class Symbol(str):
+  pass
+
+class String(str):
+  pass
+
+class Character(str):
+  pass
+
+class Float(float):
+  def __new__(cls, value, text):
+    self = float.__new__(cls, value)
+    self.text = text
+    return self
+
+CONTROLCODES = ["null", "soh", "stx", "etx", "eot", "enq", "ack", "bell", "backspace", "tab",
+  "newline", "vt", "page", "return", "so", "si", "dle", "dc1", "dc2", "dc3", "dc4", "nak", "syn",
+  "etb", "can", "em", "sub", "escape", "fs", "gs", "rs", "us", "space"]
+
+class TranslateError(Exception):
+  pass
+
+def tokenize(text):
+  i, n = 0, len(text)
+  while i < n:
+    c = text[i]
+    if c.isspace():
+      i += 1
+    elif c == ';':
+      while i < n and text[i] != '\n': i += 1
+    elif c in "()'":
+      yield c
+      i += 1
+    elif c == '"':
+      j, chars = i + 1, []
+      while j < n and text[j] != '"':
+        if text[j] == '\\': j += 1
+        chars.append(text[j])
+        j += 1
+      yield String(''.join(chars))
+      i = j + 1
+    else:
+      j = i
+      while j < n and not text[j].isspace() and text[j] not in "()":
+        j += 1
+      yield atom(text[i:j])
+      i = j
+
+def atom(token):
+  if token.startswith("#\\"):
+    name = token[2:]
+    if len(name) == 1: return Character(name)
+    if name.lower() in CONTROLCODES: return Character(chr(CONTROLCODES.index(name.lower())))
+    raise TranslateError("unknown character " + token)
+  for prefix, base in (("#x", 16), ("#o", 8), ("#b", 2)):
+    if token.lower().startswith(prefix): return int(token[2:], base)
+  if re.match(r"^[+-]?\d+$", token): return int(token)
+  if re.match(r"^[+-]?(\d+\.\d*|\.\d+|\d+)(e[+-]?\d+)?$", token, re.I) and not token.isdigit():
+    return Float(float(token), token)
+  return Symbol(token.lower())
+
+def readforms(text):
+  tokens = list(tokenize(text))
+  pos = [0]
+  def read():
+    token = tokens[pos[0]]
+    pos[0] += 1
+    if token == '(' and not isinstance(token, String):
+      items = []
+      while tokens[pos[0]] != ')' or isinstance(tokens[pos[0]], String):
+        items.append(read())
+      pos[0] += 1
+      return items
+    if token == "'" and not isinstance(token, String):
+      return [Symbol("quote"), read()]
+    if token == ')' and not isinstance(token, String):
+      raise TranslateError("unmatched right bracket")
+    return token
+  forms = []
+  while pos[0] < len(tokens):
+    forms.append(read())
+  return forms
+
+def lispprint(form):
+  if isinstance(form, list):
+    if len(form) == 2 and form[0] == "quote": return "'" + lispprint(form[1])
+    return "(" + " ".join(lispprint(x) for x in form) + ")"
+  if isinstance(form, String):
+    return '"' + form.replace("\\", "\\\\").replace('"', '\\"') + '"'
+  if isinstance(form, Character):
+    code = ord(form)
+    return "#\\" + (form if code > 32 else CONTROLCODES[code].capitalize())
+  if isinstance(form, Float): return form.text
+  return str(form)
+
+def cstring(text):
+  return '"' + text.replace("\\", "\\\\").replace('"', '\\"') + '"'
+
+# The builtins, from the string names and lookup_table in the uLisp source
+
+class Builtin:
+  def __init__(self, name, fptr, fixed, lo, hi):
+    self.name, self.fptr, self.fixed, self.min, self.max = name, fptr, fixed, lo, hi
+
+def readbuiltins(path):
+  with open(path) as f: source = f.read()
+  strings = dict(re.findall(r'const char (string\w+)\[\] PROGMEM = "(.*)";', source))
+  builtins = {}
+  table = source[source.index("const tbl_entry_t lookup_table[]"):]
+  for entry in re.finditer(r"\{ (string\w+), (\w+), (\d+), (\d+)(?:, (\w+))? \}", table):
+    name = strings[entry.group(1)]
+    fptr = None if entry.group(2) == "NULL" else entry.group(2)
+    builtins[name] = Builtin(name, fptr, entry.group(5), int(entry.group(3)), int(entry.group(4)))
+  return builtins
+
+# Builtins that evaluate Lisp code or depend on the environment, so can't be called from C
+UNSAFE = {"apply", "funcall", "mapc", "mapcar", "mapcan", "sort", "eval", "break", "gc",
+  "save-image", "load-image", "require", "edit", "locals"}
+
+ARITHMETIC = {"+": "ADD", "-": "SUBTRACT", "*": "MULTIPLY"}
+COMPARISONS = {"=": "NUMEQ", "/=": "NOTEQ", "<": "LESS", "<=": "LESSEQ", ">": "GREATER",
+  ">=": "GREATEREQ"}
+CONTROL = {"if", "when", "unless", "cond", "and", "or", "progn", "let", "let*", "setq", "incf",
+  "decf", "dotimes", "dolist", "loop", "return"}
+LOOPS = {"dotimes", "dolist", "loop"}
+
+def mangle(name):
+  return ''.join(c if c.isalnum() else '' if c == '-' else 'x%02x' % ord(c) for c in name)
+
+# Translator
+
+class Native:
+  def __init__(self, form):
+    if len(form) < 3 or not isinstance(form[1], Symbol) or not isinstance(form[2], list):
+      raise TranslateError("expected (defun name (parameters) body): " + lispprint(form))
+    self.name, self.params, body = form[1], form[2], form[3:]
+    for p in self.params:
+      if not isinstance(p, Symbol) or p.startswith("&"):
+        raise TranslateError(self.name + ": only required parameters are supported")
+    if len(body) > 1 and isinstance(body[0], String): body = body[1:]
+    self.body = body
+    self.source = form
+    self.cname = mangle(self.name)
+    self.cparams = []
+    for p in self.params:
+      c = "v_" + mangle(p)
+      while c in self.cparams: c += "_"
+      self.cparams.append(c)
+    self.enum = "NATIVE" + self.cname.upper()
+
+class Function:
+  def __init__(self, native, natives, builtins):
+    self.native, self.natives, self.builtins = native, natives, builtins
+    self.lines, self.level = [], 1
+    self.temps, self.slots, self.labels = 0, 0, 0
+    self.scope, self.loops, self.cvars, self.used = [], [], set(), set()
+    self.frame = any(self.maygc(f) for f in native.body)
+
+  def error(self, message, form=None):
+    text = self.native.name + ": " + message
+    if form is not None: text += ": " + lispprint(form)
+    raise TranslateError(text)
+
+  def emit(self, line):
+    self.lines.append("  " * self.level + line)
+
+  def temp(self, gcsafe=False):
+    if gcsafe and self.frame:
+      self.slots += 1
+      return "Stack[fp+%d]" % (self.slots - 1)
+    self.temps += 1
+    return "t%d" % self.temps
+
+  def variable(self, name):
+    if self.frame: return self.temp(True)
+    cname = "v_" + mangle(name)
+    while cname in self.cvars: cname += "_"
+    self.cvars.add(cname)
+    return cname
+
+  def lookup(self, name):
+    for frame in reversed(self.scope):
+      if name in frame: return frame[name]
+    return None
+
+  # Analysis
+
+  def maygc(self, form):
+    if not isinstance(form, list) or not form: return False
+    op = form[0]
+    if isinstance(op, Symbol) and (op in LOOPS or op in self.natives): return True
+    return op != "quote" and any(self.maygc(x) for x in form if isinstance(x, list))
+
+  def trivial(self, form):
+    return not isinstance(form, list) or (form and form[0] == "quote")
+
+  def simple(self, form):
+    # Translates to a C expression with no statements
+    if self.trivial(form): return True
+    if not form or not isinstance(form[0], Symbol): return False
+    op = form[0]
+    if op in ("not", "null"): return len(form) == 2 and self.simple(form[1])
+    if op == "if": return len(form) in (3, 4) and all(self.simple(x) for x in form[1:])
+    if op in CONTROL or op in self.natives: return False
+    # Otherwise the arguments before the last non-trivial one are kept in temporaries
+    args = form[1:]
+    return all(self.simple(x) for x in args) and sum(not self.trivial(x) for x in args) <= 1
+
+  # Expressions
+
+  def constant(self, form):
+    if form is None or form == "nil" and isinstance(form, Symbol): return "nil"
+    if isinstance(form, Float): return "makefloat(%s)" % form.text
+    if isinstance(form, Character):
+      return "character(%s)" % ("'\\''" if form == "'" else "'\\\\'" if form == "\\" else
+        "'%s'" % form if 32 <= ord(form) < 127 else "%d" % ord(form))
+    if isinstance(form, int):
+      if not -2**31 <= form < 2**31: self.error("integer out of range", form)
+      return "number(%d)" % form
+    if isinstance(form, String): self.error("strings aren't supported", form)
+    if isinstance(form, list) and form == []: return "nil"
+    return None
+
+  def value(self, form):
+    c = self.constant(form)
+    if c is not None: return c
+    if isinstance(form, Symbol):
+      if form == "t": return "tee"
+      v = self.lookup(form)
+      if v is None: self.error("global variables aren't supported", form)
+      return v
+    op = form[0]
+    if not isinstance(op, Symbol): self.error("illegal function", form)
+    if op == "quote":
+      c = self.constant(form[1]) if len(form) == 2 else None
+      if c is None: self.error("only numbers and nil can be quoted", form)
+      return c
+    if op in ("not", "null"):
+      self.arity(form, 1, 1)
+      if self.simple(form[1]): return "(%s == nil ? tee : nil)" % self.value(form[1])
+      return "(%s ? nil : tee)" % self.test(form[1])
+    if op == "if" and self.simple(form):
+      self.arity(form, 2, 3)
+      other = self.value(form[3]) if len(form) == 4 else "nil"
+      return "(%s ? %s : %s)" % (self.test(form[1]), self.value(form[2]), other)
+    if op in CONTROL:
+      t = self.temp()
+      self.into(form, t)
+      return t
+    if op in COMPARISONS and len(form) == 3:
+      return "(%s ? tee : nil)" % self.test(form)
+    if op in ARITHMETIC and len(form) == 3:
+      a, b = self.arguments(form[1:])
+      if isinstance(form[2], int) and -2**31 <= form[2] < 2**31:
+        return "nativearithint(%s, %s, %d)" % (ARITHMETIC[op], a, form[2])
+      return "nativearith(%s, %s, %s)" % (ARITHMETIC[op], a, b)
+    if op in self.natives:
+      callee = self.natives[op]
+      if len(form) - 1 != len(callee.params): self.error("wrong number of arguments", form)
+      return "native_%s(%s)" % (callee.cname, ", ".join(self.arguments(form[1:]) + ["env"]))
+    return self.builtin(form)
+
+  def builtin(self, form):
+    op = form[0]
+    b = self.builtins.get(op)
+    if b is None: self.error("can only call builtins and the functions being translated", form)
+    if op in UNSAFE or (b.fptr or "fn_").startswith(("sp_", "tf_")):
+      self.error("can't call " + op + " from C", form)
+    nargs = len(form) - 1
+    if not b.min <= nargs <= b.max: self.error("wrong number of arguments", form)
+    args = self.arguments(form[1:])
+    if b.fixed and nargs == (b.min if b.min == b.max else 2):
+      return "nativefixed(%s)" % ", ".join([b.fixed] + args)
+    if b.fptr is None: self.error("can't call " + op + " with this number of arguments", form)
+    lst = "NULL"
+    for a in reversed(args): lst = "cons(%s, %s)" % (a, lst)
+    return "%s(%s, NULL)" % (b.fptr, lst)
+
+  def arguments(self, forms):
+    # Evaluated in order, keeping earlier values across later statements and safepoints
+    result = []
+    for i, f in enumerate(forms):
+      v = self.value(f)
+      later = forms[i+1:]
+      statements = any(not self.simple(x) for x in later)
+      if statements or (not self.trivial(f) and any(not self.trivial(x) for x in later)):
+        t = self.temp(any(self.maygc(x) for x in later))
+        self.assign(t, v, f)
+        v = t
+      result.append(v)
+    return result
+
+  def test(self, form):
+    # A C condition that's true unless form is nil
+    if isinstance(form, list) and form and isinstance(form[0], Symbol):
+      op = form[0]
+      if op in COMPARISONS and len(form) == 3:
+        a, b = self.arguments(form[1:])
+        if isinstance(form[2], int) and -2**31 <= form[2] < 2**31:
+          return "nativetestint(%s, %s, %d)" % (COMPARISONS[op], a, form[2])
+        return "nativetest(%s, %s, %s)" % (COMPARISONS[op], a, b)
+      if op in ("not", "null") and len(form) == 2:
+        return "!(%s)" % self.test(form[1])
+      if op in ("and", "or") and len(form) > 1 and all(self.simple(x) for x in form[1:]):
+        join = " && " if op == "and" else " || "
+        return "(" + join.join(self.test(x) for x in form[1:]) + ")"
+    return "%s != nil" % self.value(form)
+
+  # Statements
+
+  def block(self, forms, target):
+    # Evaluates forms in turn, putting the value of the last in target
+    forms = [f for f in forms if not (isinstance(f, list) and f and f[0] == "declare")]
+    if not forms:
+      if target: self.emit("%s = nil;" % target)
+      return
+    for f in forms[:-1]: self.into(f, None)
+    self.into(forms[-1], target)
+
+  def assign(self, target, v, form):
+    # A native function can move the stack, so store its result in a slot after the call
+    if target.startswith("Stack[") and self.maygc(form):
+      t = self.temp()
+      self.emit("%s = %s;" % (t, v))
+      v = t
+    self.emit("%s = %s;" % (target, v))
+
+  def branch(self, condition, then, otherwise):
+    start = len(self.lines)
+    self.emit("if (%s) {" % condition)
+    self.level += 1
+    then()
+    if len(self.lines) == start + 1:
+      self.lines[start] = "  " * (self.level - 1) + "if (!(%s)) {" % condition
+      then = None
+    else:
+      self.level -= 1
+      self.emit("} else {")
+      self.level += 1
+    mark = len(self.lines)
+    otherwise()
+    self.level -= 1
+    if then is not None and len(self.lines) == mark: self.lines[-1] = "  " * self.level + "}"
+    else: self.emit("}")
+
+  def into(self, form, target):
+    if not isinstance(form, list) or not form or not isinstance(form[0], Symbol) or form[0] not in CONTROL:
+      v = self.value(form)
+      if target: self.assign(target, v, form)
+      elif not self.trivial(form): self.emit("%s;" % v)
+      return
+    op, args = form[0], form[1:]
+    if op == "progn":
+      self.block(args, target)
+    elif op == "if":
+      self.arity(form, 2, 3)
+      self.branch(self.test(args[0]), lambda: self.into(args[1], target),
+        lambda: self.into(args[2] if len(args) == 3 else None, target))
+    elif op in ("when", "unless"):
+      self.arity(form, 1, None)
+      condition = self.test(args[0])
+      if op == "unless": condition = "!(%s)" % condition
+      self.branch(condition, lambda: self.block(args[1:], target),
+        lambda: self.into(None, target))
+    elif op == "cond":
+      self.cond(args, target)
+    elif op in ("and", "or"):
+      self.logical(op, args, target)
+    elif op in ("let", "let*"):
+      self.let(op, args, target)
+    elif op == "setq":
+      if len(args) % 2 != 0: self.error("odd number of parameters", form)
+      v = "nil"
+      for var, f in zip(args[0::2], args[1::2]):
+        v = self.variableref(var, form)
+        self.into(f, v)
+      if target: self.emit("%s = %s;" % (target, v))
+    elif op in ("incf", "decf"):
+      self.arity(form, 1, 2)
+      v = self.variableref(args[0], form)
+      kind = "ADD" if op == "incf" else "SUBTRACT"
+      if len(args) == 1 or isinstance(args[1], int) and -2**31 <= args[1] < 2**31:
+        self.emit("%s = nativearithint(%s, %s, %d);" % (v, kind, v, 1 if len(args) == 1 else args[1]))
+      else:
+        self.assign(v, "nativearith(%s, %s, %s)" % (kind, v, self.value(args[1])), args[1])
+      if target: self.emit("%s = %s;" % (target, v))
+    elif op in LOOPS:
+      self.loop(op, args, target, form)
+    elif op == "return":
+      if not self.loops: self.error("return outside a loop", form)
+      looptarget, label = self.loops[-1]
+      self.block(args, looptarget)
+      self.emit("goto %s;" % label)
+      self.used.add(label)
+
+  def variableref(self, var, form):
+    v = self.lookup(var) if isinstance(var, Symbol) else None
+    if v is None: self.error("can only set local variables", form)
+    return v
+
+  def cond(self, clauses, target):
+    if not clauses:
+      self.into(None, target)
+      return
+    clause, rest = clauses[0], clauses[1:]
+    if not isinstance(clause, list) or not clause: self.error("illegal clause", clause)
+    if len(clause) == 1:
+      t = target or self.temp()
+      self.into(clause[0], t)
+      self.branch("%s != nil" % t, lambda: None, lambda: self.cond(rest, target))
+    else:
+      self.branch(self.test(clause[0]), lambda: self.block(clause[1:], target),
+        lambda: self.cond(rest, target))
+
+  def logical(self, op, args, target):
+    t = target or self.temp()
+    if not args:
+      self.emit("%s = %s;" % (t, "tee" if op == "and" else "nil"))
+      return
+    self.into(args[0], t)
+    depth = 0
+    for f in args[1:]:
+      self.emit("if (%s %s nil) {" % (t, "!=" if op == "and" else "=="))
+      self.level += 1
+      depth += 1
+      self.into(f, t)
+    for _ in range(depth):
+      self.level -= 1
+      self.emit("}")
+
+  def let(self, op, args, target):
+    self.arity([op] + args, 1, None)
+    bindings = {}
+    self.scope.append(bindings if op == "let*" else {})
+    for b in args[0]:
+      var, init = (b, None) if isinstance(b, Symbol) else (b[0], b[1] if len(b) > 1 else None)
+      if not isinstance(var, Symbol): self.error("illegal binding", b)
+      v = self.variable(var)
+      if not self.frame: self.emit("object *%s;" % v)
+      self.into(init, v)
+      bindings[var] = v
+    if op == "let": self.scope[-1] = bindings
+    self.block(args[1:], target)
+    self.scope.pop()
+
+  def loop(self, op, args, target, form):
+    self.labels += 1
+    label = "loop%d" % self.labels
+    self.emit("{")
+    self.level += 1
+    self.loops.append((target, label))
+    if op == "loop":
+      self.emit("for (;;) {")
+      self.level += 1
+      self.block(args, None)
+    else:
+      params = args[0] if args and isinstance(args[0], list) else []
+      if len(params) < 2 or not isinstance(params[0], Symbol): self.error("illegal parameters", form)
+      var, result = self.variable(params[0]), params[2:]
+      if not self.frame: self.emit("object *%s;" % var)
+      if op == "dotimes":
+        count, index = "count%d" % self.labels, "index%d" % self.labels
+        n = params[1] if isinstance(params[1], int) else "checkinteger(DOTIMES, %s)" % self.value(params[1])
+        self.emit("int %s = %s, %s = 0;" % (count, n, index))
+        self.emit("while (%s < %s) {" % (index, count))
+        self.level += 1
+        self.emit("%s = number(%s);" % (var, index))
+      else:
+        lst, index = self.temp(True), "index%d" % self.labels
+        self.into(params[1], lst)
+        self.emit("int %s = 0;" % index)
+        self.emit("while (dolistitem(&%s, &%s, &%s)) {" % (lst, index, var))
+        self.level += 1
+      self.scope.append({params[0]: var})
+      self.block(args[1:], None)
+      self.scope.pop()
+      if op == "dotimes": self.emit("%s++;" % index)
+    self.emit("safepoint(NULL, env);")
+    self.level -= 1
+    self.emit("}")
+    self.loops.pop()
+    if op == "dotimes":
+      self.emit("%s = number(%s);" % (var, index))
+    elif op == "dolist":
+      self.emit("%s = nil;" % var)
+    if op != "loop":
+      self.scope.append({params[0]: var})
+      self.block(result, target)
+      self.scope.pop()
+    self.level -= 1
+    self.emit("}")
+    if label in self.used: self.emit("%s: ;" % label)
+
+  def arity(self, form, lo, hi):
+    n = len(form) - 1
+    if n < lo or (hi is not None and n > hi): self.error("wrong number of arguments", form)
+
+  def translate(self):
+    native = self.native
+    params = {}
+    for p, c in zip(native.params, native.cparams):
+      params[p] = self.temp(True) if self.frame else c
+      self.cvars.add(c)
+    self.scope.append(params)
+    if self.frame:
+      self.emit("unsigned int fp = nativeframe(FRAMESIZE);")
+      for p, c in zip(native.params, native.cparams): self.emit("%s = %s;" % (params[p], c))
+      self.emit("safepoint(NULL, env);")
+    else: self.emit("(void) env;")
+    self.emit("RESULT")
+    self.block(native.body, "result")
+    if self.frame: self.emit("StackTop = fp;")
+    self.emit("return result;")
+    decls = ["result"] + ["t%d" % i for i in range(1, self.temps + 1)]
+    body = [line.replace("FRAMESIZE", str(self.slots)) for line in self.lines]
+    body[body.index("  RESULT")] = "  object *" + ", *".join(decls) + ";"
+    return body
+
+def prototype(native):
+  params = ["object *" + c for c in native.cparams] + ["object *env"]
+  return "object *native_%s (%s)" % (native.cname, ", ".join(params))
+
+def entrypoint(native):
+  # Fixed-arity entry points take up to three arguments
+  n = len(native.params)
+  if n <= 3:
+    args = ["args[%d]" % i for i in range(n)] + ["env"]
+    return ("object *fn_native_%s (object **args, object *env) {" % native.cname,
+      ["  (void) args;"] * (n == 0) + ["  return native_%s(%s);" % (native.cname, ", ".join(args))])
+  args = []
+  lines = []
+  for i, p in enumerate(native.params):
+    lines.append("  object *arg%d = first(args); args = cdr(args);" % i)
+    args.append("arg%d" % i)
+  lines.append("  return native_%s(%s);" % (native.cname, ", ".join(args + ["env"])))
+  return ("object *fn_native_%s (object *args, object *env) {" % native.cname, lines)
+
+def generate(forms, corpus, builtins, inputname):
+  natives = {}
+  for form in forms:
+    if not (isinstance(form, list) and form and form[0] == "defun"):
+      raise TranslateError("expected a defun: " + lispprint(form))
+    native = Native(form)
+    if native.name in builtins: raise TranslateError(native.name + " is already a builtin")
+    if any(n.cname == native.cname for n in natives.values()):
+      raise TranslateError(native.name + " has the same C name as another function")
+    natives[native.name] = native
+
+  out = ["/* Native functions - generated by tools/lisp2c.py from %s; don't edit */" % inputname, ""]
+  out.append("#if !defined(MODULEDEFINITIONS)")
+  entries = []
+  for n in natives.values():
+    fixed = len(n.params) <= 3
+    entries.append("  entry(%s, %s, %s, %s, %d, %d)" % (n.enum, cstring(n.name),
+      "NULL" if fixed else "fn_native_" + n.cname, "fn_native_" + n.cname if fixed else "NULL",
+      len(n.params), len(n.params)))
+  out.append("#define NATIVEFUNCTIONS(entry) \\")
+  out.extend(e + " \\" for e in entries)
+  out.append("")
+  out.append("#else")
+  out.append("")
+  for n in natives.values(): out.append(prototype(n) + ";")
+  for n in natives.values():
+    body = Function(n, natives, builtins).translate()
+    out.append("")
+    out.append(prototype(n) + " {")
+    out.extend(body)
+    out.append("}")
+    header, lines = entrypoint(n)
+    out.append("")
+    out.append(header)
+    out.extend(lines)
+    out.append("}")
+  out.append("")
+  out.append("// The definitions and test expressions for checknatives()")
+  out.append("")
+  out.append("const char NativeSource[] PROGMEM = ")
+  out.extend(cstring(lispprint(n.source)) for n in natives.values())
+  out.append(";")
+  out.append("")
+  out.append("const char NativeCorpus[] PROGMEM = ")
+  out.extend([cstring(lispprint(f)) for f in corpus] or ['""'])
+  out.append(";")
+  out.append("")
+  out.append("#endif")
+  return "\n".join(out) + "\n"
+
+def main():
+  root = os.path.join(os.path.dirname(os.path.abspath(__file__)), "..")
+  parser = argparse.ArgumentParser(description="Translate uLisp defuns into C builtins.")
+  parser.add_argument("input", help="file of defuns to translate")
+  parser.add_argument("--corpus", help="file of test expressions to compare with the interpreter")
+  parser.add_argument("-o", "--output", default=os.path.join(root, "include", "NativeFunctions.h"))
+  parser.add_argument("--source", default=os.path.join(root, "src", "ulisp-esp.cpp"),
+    help="uLisp source giving the builtins")
+  args = parser.parse_args()
+  try:
+    with open(args.input) as f: forms = readforms(f.read())
+    corpus = []
+    if args.corpus:
+      with open(args.corpus) as f: corpus = readforms(f.read())
+    text = generate(forms, corpus, readbuiltins(args.source), os.path.basename(args.input))
+  except TranslateError as e:
+    sys.exit("lisp2c: " + str(e))
+  with open(args.output, "w") as f: f.write(text)
+
+if __name__ == "__main__":
+  main()
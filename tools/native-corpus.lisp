@@ -0,0 +1,26 @@
+; Expressions evaluated with the native functions and with the interpreter, whose results must agree
+
+(fib 0)
+(fib 1)
+(fib 15)
+(fib 2.5)
+(fib 'x)
+(gcd 12 18)
+(gcd 17 5)
+(gcd 0 9)
+(gcd 9 0)
+(gcd -12 18)
+(gcd 1.5 2)
+(isqrt 0)
+(isqrt 15)
+(isqrt 16)
+(isqrt 1000000)
+(isqrt 2147483647)
+(crc8 '(1 2 3 4))
+(crc8 '(49 50 51 52 53 54 55 56 57))
+(crc8 '(1 . 2))
+(parse-integer "1234")
+(parse-integer "-42abc")
+(parse-integer "99999999999")
+(parse-integer "")
+(parse-integer 5)
@@ -0,0 +1,40 @@
+; Functions translated to C by lisp2c.py - regenerate include/NativeFunctions.h after changing them:
+; python3 tools/lisp2c.py tools/native.lisp --corpus tools/native-corpus.lisp
+
+(defun fib (n)
+  (if (< n 2) n (+ (fib (- n 1)) (fib (- n 2)))))
+
+(defun gcd (a b)
+  (loop
+   (when (zerop b) (return a))
+   (let ((r (mod a b)))
+     (setq a b)
+     (setq b r))))
+
+(defun isqrt (n)
+  "Integer square root by Newton's method."
+  (if (< n 2) n
+    (let* ((x n) (y (ash (+ x 1) -1)))
+      (loop
+       (unless (< y x) (return x))
+       (setq x y)
+       (setq y (ash (+ x (truncate n x)) -1))))))
+
+(defun crc8 (bytes)
+  "CRC-8 with polynomial #x07 of a list of bytes."
+  (let ((crc 0))
+    (dolist (b bytes crc)
+      (setq crc (logxor crc b))
+      (dotimes (i 8)
+        (setq crc (if (logbitp 7 crc) (logand (logxor (ash crc 1) 7) 255) (logand (ash crc 1) 255)))))))
+
+(defun parse-integer (str)
+  "Value of the decimal digits at the start of str, after an optional sign."
+  (let ((result 0) (sign 1) (start 0) (len (length str)))
+    (when (and (> len 0) (eq (char str 0) #\-))
+      (setq sign -1 start 1))
+    (dotimes (i (- len start))
+      (let ((d (- (char-code (char str (+ i start))) 48)))
+        (when (or (< d 0) (> d 9)) (return))
+        (setq result (+ (* result 10) d))))
+    (* sign result)))